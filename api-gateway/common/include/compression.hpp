@@ -0,0 +1,53 @@
+#ifndef COMPRESSION_HPP
+#define COMPRESSION_HPP
+
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <zlib.h>
+
+// gzip/deflate response bodies negotiated from Accept-Encoding.
+namespace compression {
+
+// "gzip", "deflate" or "" (identity). gzip wins when both are accepted; q=0 excludes a coding.
+inline std::string negotiate(const std::string& accept_encoding) {
+    auto accepts = [&](const char* coding) {
+        auto pos = accept_encoding.find(coding);
+        if (pos == std::string::npos) return false;
+        auto end = accept_encoding.find(',', pos);
+        auto params = accept_encoding.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+        auto q = params.find("q=");
+        return q == std::string::npos || std::strtod(params.c_str() + q + 2, nullptr) > 0;
+    };
+    if (accepts("gzip")) return "gzip";
+    if (accepts("deflate")) return "deflate";
+    return {};
+}
+
+inline std::string compress(const std::string& body, const std::string& encoding) {
+    z_stream stream{};
+    // 15 + 16 selects the gzip wrapper; plain 15 the zlib wrapper that HTTP calls "deflate".
+    int window_bits = encoding == "gzip" ? 15 + 16 : 15;
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("deflateInit2 failed");
+    }
+
+    std::string out(deflateBound(&stream, static_cast<uLong>(body.size())), '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(body.data()));
+    stream.avail_in = static_cast<uInt>(body.size());
+    stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    stream.avail_out = static_cast<uInt>(out.size());
+
+    int result = deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    if (result != Z_STREAM_END) {
+        throw std::runtime_error("deflate failed");
+    }
+    return out;
+}
+
+}
+
+#endif
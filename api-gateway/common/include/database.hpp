@@ -1,10 +1,16 @@
 #ifndef DATABASE_HPP
 #define DATABASE_HPP
 
+#include <chrono>
+#include <functional>
+#include <iostream>
 #include <memory>
+#include <stdexcept>
 #include <string>
 #include <utility>
+#include <vector>
 #include <pqxx/pqxx>
+#include "read_replica.hpp"
 
 class Database {
 public:
@@ -16,6 +22,20 @@ public:
 
     pqxx::transaction_base& begin_transaction();
 
+    // Optional read replica for query_read(). It is used while its replay lag, checked at most
+    // once per lag_check_interval, stays within max_lag; otherwise, or while it is unreachable,
+    // reads fall back to the primary. Call before the Database is shared between threads.
+    void attach_replica(const std::string& host,
+                        const std::string& port,
+                        const std::string& dbname,
+                        const std::string& user,
+                        const std::string& password,
+                        std::chrono::milliseconds max_lag,
+                        std::chrono::milliseconds lag_check_interval);
+
+    // Reads through the same replica as other, sharing its connections and lag checks.
+    void share_replica(const Database& other) { replica_ = other.replica_; }
+
     void commit() {
         if (transaction_) {
             transaction_->commit();
@@ -48,11 +68,31 @@ public:
     template<typename... Args>
     void execute(pqxx::transaction_base& tx, const std::string& sql, Args&&... args);
 
+    // Read-only statement outside a transaction; served by the replica when it is in sync.
+    template<typename... Args>
+    pqxx::result query_read(const std::string& sql, Args&&... args);
+
+    // Subscribes this connection to a NOTIFY channel. The handler gets each payload, and only
+    // runs inside wait_for_notifications(), on the caller's thread.
+    void listen(const std::string& channel, std::function<void(const std::string&)> handler);
+    // Blocks up to timeout for notifications; returns how many were handled.
+    int wait_for_notifications(std::chrono::milliseconds timeout);
+
     void initialize_schema();
 
+    // Postgres array literal for binding a list as one text parameter, e.g. $1::text[].
+    static std::string array_literal(const std::vector<std::string>& values);
+
+    // bytea hex form ("\x..."), for values written through COPY (pqxx::stream_to).
+    static std::string bytea_hex(const std::string& bytes);
+
 private:
     std::unique_ptr<pqxx::connection> conn_;
     std::unique_ptr<pqxx::work> transaction_;
+    std::vector<std::unique_ptr<pqxx::notification_receiver>> receivers_;
+
+    // Thread-safe; query_read() may be called from any number of threads at once.
+    std::shared_ptr<ReadReplica> replica_;
 };
 
 template<typename... Args>
@@ -78,4 +118,20 @@ void Database::execute(pqxx::transaction_base& tx, const std::string& sql, Args&
     tx.exec_params(sql, std::forward<Args>(args)...);
 }
 
+template<typename... Args>
+pqxx::result Database::query_read(const std::string& sql, Args&&... args) {
+    if (replica_) {
+        if (auto lease = replica_->acquire()) {
+            try {
+                pqxx::nontransaction nt(*lease);
+                return nt.exec_params(sql, args...);
+            } catch (const pqxx::broken_connection& e) {
+                std::cerr << "Read replica unavailable, using primary: " << e.what() << std::endl;
+                lease.discard();
+            }
+        }
+    }
+    return query(sql, std::forward<Args>(args)...);
+}
+
 #endif
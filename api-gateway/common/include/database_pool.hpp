@@ -0,0 +1,86 @@
+#ifndef DATABASE_POOL_HPP
+#define DATABASE_POOL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "database.hpp"
+
+// Up to size Databases for code running on many threads at once, e.g. HTTP handlers. A
+// Database (its connection and open transaction) belongs to one lease at a time, so no two
+// threads ever use it together. Connections are opened on demand; acquire() blocks while all
+// of them are leased.
+class DatabasePool {
+public:
+    using Factory = std::function<std::shared_ptr<Database>()>;
+
+    class Lease {
+    public:
+        Lease(DatabasePool* owner, std::shared_ptr<Database> db) : owner_(owner), db_(std::move(db)) {}
+        Lease(Lease&& other) noexcept : owner_(other.owner_), db_(std::move(other.db_)) {}
+        Lease& operator=(Lease&&) = delete;
+        ~Lease() {
+            if (db_) owner_->release(std::move(db_));
+        }
+
+        Database* operator->() { return db_.get(); }
+        Database& operator*() { return *db_; }
+
+    private:
+        DatabasePool* owner_;
+        std::shared_ptr<Database> db_;
+    };
+
+    DatabasePool(Factory connect, std::size_t size)
+        : connect_(std::move(connect)), size_(size == 0 ? 1 : size) {}
+
+    DatabasePool(const DatabasePool&) = delete;
+    DatabasePool& operator=(const DatabasePool&) = delete;
+
+    // Keep the lease for one unit of work only; a request that waits on something else
+    // should acquire again afterwards rather than hold a connection idle.
+    Lease acquire() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        available_.wait(lock, [this]() { return !idle_.empty() || opened_ < size_; });
+        if (!idle_.empty()) {
+            auto db = std::move(idle_.back());
+            idle_.pop_back();
+            return Lease(this, std::move(db));
+        }
+
+        // Connect without the lock so other leases come and go meanwhile.
+        ++opened_;
+        lock.unlock();
+        try {
+            return Lease(this, connect_());
+        } catch (...) {
+            lock.lock();
+            --opened_;
+            available_.notify_one();
+            throw;
+        }
+    }
+
+private:
+    void release(std::shared_ptr<Database> db) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            idle_.push_back(std::move(db));
+        }
+        available_.notify_one();
+    }
+
+    Factory connect_;
+    std::size_t size_;
+
+    std::mutex mutex_;
+    std::condition_variable available_;
+    std::vector<std::shared_ptr<Database>> idle_;
+    std::size_t opened_{0};
+};
+
+#endif
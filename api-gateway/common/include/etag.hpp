@@ -0,0 +1,69 @@
+#ifndef ETAG_HPP
+#define ETAG_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Entity tags for conditional GETs. Callers feed the fields that change whenever the
+// representation changes (e.g. id, status and version), so a tag can be computed and
+// compared before any body is serialized.
+namespace etag {
+
+class Builder {
+public:
+    Builder& add(const std::string& field) {
+        for (unsigned char c : field) {
+            hash_ ^= c;
+            hash_ *= 1099511628211ULL;
+        }
+        // Separator, so ("ab", "c") and ("a", "bc") differ.
+        hash_ ^= 0xff;
+        hash_ *= 1099511628211ULL;
+        return *this;
+    }
+
+    Builder& add(std::int64_t value) {
+        return add(std::to_string(value));
+    }
+
+    // Quoted, as sent in the ETag header.
+    std::string str() const {
+        static const char digits[] = "0123456789abcdef";
+        std::string tag(18, '"');
+        for (int i = 0; i < 16; ++i) {
+            tag[static_cast<std::size_t>(16 - i)] = digits[(hash_ >> (i * 4)) & 0xf];
+        }
+        return tag;
+    }
+
+private:
+    std::uint64_t hash_{14695981039346656037ULL};
+};
+
+// If-None-Match is "*" or a comma-separated list of tags; it uses weak comparison, so a
+// "W/" prefix is ignored.
+inline bool matches(const std::string& if_none_match, const std::string& tag) {
+    std::size_t pos = 0;
+    while (pos < if_none_match.size()) {
+        auto end = if_none_match.find(',', pos);
+        if (end == std::string::npos) end = if_none_match.size();
+
+        auto first = if_none_match.find_first_not_of(" \t", pos);
+        auto last = if_none_match.find_last_not_of(" \t", end - 1);
+        if (first != std::string::npos && first < end && last != std::string::npos && last >= first) {
+            if (if_none_match.compare(first, 2, "W/") == 0) first += 2;
+            auto length = last - first + 1;
+            if ((length == 1 && if_none_match[first] == '*') ||
+                if_none_match.compare(first, length, tag) == 0) {
+                return true;
+            }
+        }
+        pos = end + 1;
+    }
+    return false;
+}
+
+}
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef EVENT_BATCH_HPP
+#define EVENT_BATCH_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+
+// Batch envelopes carry several already-encoded events of one content type in a single AMQP
+// message, marked by the AMQP `type` property. Each event is framed as a 4-byte big-endian
+// length followed by its bytes.
+namespace event_batch {
+
+inline const char* message_type() {
+    return "event-batch";
+}
+
+inline void append(std::string& envelope, const std::string& event) {
+    auto size = static_cast<std::uint32_t>(event.size());
+    envelope.push_back(static_cast<char>((size >> 24) & 0xff));
+    envelope.push_back(static_cast<char>((size >> 16) & 0xff));
+    envelope.push_back(static_cast<char>((size >> 8) & 0xff));
+    envelope.push_back(static_cast<char>(size & 0xff));
+    envelope.append(event);
+}
+
+inline std::vector<std::string> unpack(const std::string& envelope) {
+    std::vector<std::string> events;
+    std::size_t pos = 0;
+    while (pos < envelope.size()) {
+        if (envelope.size() - pos < 4) {
+            throw std::runtime_error("Truncated event batch header");
+        }
+        std::uint32_t size = 0;
+        for (int i = 0; i < 4; ++i) {
+            size = (size << 8) | static_cast<unsigned char>(envelope[pos++]);
+        }
+        if (envelope.size() - pos < size) {
+            throw std::runtime_error("Truncated event batch body");
+        }
+        events.emplace_back(envelope, pos, size);
+        pos += size;
+    }
+    return events;
+}
+
+// Groups outgoing events by destination and content type, publishing an envelope whenever it
+// reaches max_events or max_bytes and the rest on finish(). A group holding a single event is
+// published as a plain message, so consumers that predate envelopes keep working at low load.
+class Batcher {
+public:
+    using Publish = std::function<void(const std::string& destination, const std::string& body,
+                                       const std::string& content_type, bool batch)>;
+
+    Batcher(std::size_t max_events, std::size_t max_bytes, Publish publish)
+        : max_events_(max_events ? max_events : 1), max_bytes_(max_bytes), publish_(std::move(publish)) {
+    }
+
+    // payload is referenced, not copied, and must stay alive until finish().
+    void add(const std::string& destination, const std::string& content_type,
+             const std::string& event_id, const std::string& payload) {
+        auto& group = groups_[{destination, content_type}];
+        auto framed = payload.size() + 4;
+        if (!group.ids.empty() && (group.ids.size() >= max_events_ || group.bytes + framed > max_bytes_)) {
+            flush(destination, content_type, group);
+        }
+        group.ids.push_back(event_id);
+        group.payloads.push_back(&payload);
+        group.bytes += framed;
+    }
+
+    // Flushes what is left and returns the IDs of every event that made it to the broker.
+    std::vector<std::string> finish() {
+        for (auto& entry : groups_) {
+            flush(entry.first.first, entry.first.second, entry.second);
+        }
+        groups_.clear();
+
+        std::vector<std::string> published;
+        published.swap(published_);
+        return published;
+    }
+
+private:
+    struct Group {
+        std::vector<std::string> ids;
+        std::vector<const std::string*> payloads;
+        std::size_t bytes{0};
+    };
+
+    void flush(const std::string& destination, const std::string& content_type, Group& group) {
+        if (group.ids.empty()) return;
+
+        try {
+            if (group.payloads.size() == 1) {
+                publish_(destination, *group.payloads.front(), content_type, false);
+            } else {
+                std::string envelope;
+                envelope.reserve(group.bytes);
+                for (const auto* payload : group.payloads) {
+                    append(envelope, *payload);
+                }
+                publish_(destination, envelope, content_type, true);
+            }
+            published_.insert(published_.end(), group.ids.begin(), group.ids.end());
+        } catch (const std::exception& e) {
+            std::cerr << "Failed to publish " << group.ids.size() << " outbox event(s) to "
+                      << destination << ": " << e.what() << std::endl;
+        }
+
+        group.ids.clear();
+        group.payloads.clear();
+        group.bytes = 0;
+    }
+
+    std::size_t max_events_;
+    std::size_t max_bytes_;
+    Publish publish_;
+    std::map<std::pair<std::string, std::string>, Group> groups_;
+    std::vector<std::string> published_;
+};
+
+}
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef EVENT_CODEC_HPP
+#define EVENT_CODEC_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+#include <nlohmann/json.hpp>
+
+// Encoding of internal events (payment requests/results), both in outbox payload columns and
+// on the wire. Producers pick one with EVENT_ENCODING; consumers decode by content type, so
+// JSON from older producers keeps working next to binary events.
+namespace event_codec {
+
+using json = nlohmann::json;
+
+enum class Encoding {
+    json,
+    msgpack,
+    cbor
+};
+
+inline Encoding parse_encoding(const std::string& name) {
+    if (name == "json") return Encoding::json;
+    if (name == "msgpack") return Encoding::msgpack;
+    if (name == "cbor") return Encoding::cbor;
+    throw std::runtime_error("Unknown event encoding: " + name);
+}
+
+inline const char* content_type(Encoding encoding) {
+    switch (encoding) {
+        case Encoding::msgpack: return "application/msgpack";
+        case Encoding::cbor: return "application/cbor";
+        case Encoding::json: break;
+    }
+    return "application/json";
+}
+
+// Anything unrecognised, including a missing content type, is treated as JSON.
+inline Encoding from_content_type(const std::string& type) {
+    if (type == "application/msgpack" || type == "application/x-msgpack") return Encoding::msgpack;
+    if (type == "application/cbor") return Encoding::cbor;
+    return Encoding::json;
+}
+
+inline std::string encode(const json& value, Encoding encoding) {
+    std::vector<std::uint8_t> bytes;
+    switch (encoding) {
+        case Encoding::msgpack:
+            json::to_msgpack(value, bytes);
+            break;
+        case Encoding::cbor:
+            json::to_cbor(value, bytes);
+            break;
+        case Encoding::json:
+            return value.dump();
+    }
+    return std::string(bytes.begin(), bytes.end());
+}
+
+inline json decode(const std::string& payload, Encoding encoding) {
+    switch (encoding) {
+        case Encoding::msgpack: return json::from_msgpack(payload);
+        case Encoding::cbor: return json::from_cbor(payload);
+        case Encoding::json: break;
+    }
+    return json::parse(payload);
+}
+
+inline json decode(const std::string& payload, const std::string& type) {
+    return decode(payload, from_content_type(type));
+}
+
+}
+
+#endif
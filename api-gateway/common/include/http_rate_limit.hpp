@@ -0,0 +1,50 @@
+#ifndef HTTP_RATE_LIMIT_HPP
+#define HTTP_RATE_LIMIT_HPP
+
+#include <algorithm>
+#include <string>
+#include <httplib.h>
+#include "rate_limiter.hpp"
+
+// RateLimiter glue shared by the HTTP services.
+namespace rate_limit {
+
+// Requests are keyed by user where the handler knows one, else by client address (nginx sets X-Real-IP).
+inline std::string client_key(const httplib::Request& req) {
+    auto real_ip = req.get_header_value("X-Real-IP");
+    return "ip:" + (real_ip.empty() ? req.remote_addr : real_ip);
+}
+
+inline std::string user_key(const httplib::Request& req, const std::string& user_id) {
+    return user_id.empty() ? client_key(req) : "user:" + user_id;
+}
+
+// Answers 429 with Retry-After when key is over the route's budget; call before any parsing or DB work.
+inline bool admit(RateLimiter& limiter, const std::string& route, const std::string& key, httplib::Response& res) {
+    auto decision = limiter.acquire(route, key);
+    if (decision.allowed) return true;
+
+    auto seconds = std::max<long long>(1, (decision.retry_after.count() + 999) / 1000);
+    res.status = 429;
+    res.set_header("Retry-After", std::to_string(seconds));
+    res.set_content("{\"error\":\"Too many requests\"}", "application/json");
+    return false;
+}
+
+// For requests acting on the user named by the body's "user_id". Call admit_body_user before
+// parsing, then admit_parsed_user with the parsed value: the peek can be misled, e.g. by an
+// escaped "user_id" earlier in the body, so the parsed user is charged as well when it differs.
+inline bool admit_body_user(RateLimiter& limiter, const std::string& route,
+                            const httplib::Request& req, httplib::Response& res) {
+    return admit(limiter, route, user_key(req, peek_json_string(req.body, "user_id")), res);
+}
+
+inline bool admit_parsed_user(RateLimiter& limiter, const std::string& route, const httplib::Request& req,
+                              const std::string& user_id, httplib::Response& res) {
+    if (user_id == peek_json_string(req.body, "user_id")) return true;
+    return admit(limiter, route, user_key(req, user_id), res);
+}
+
+}
+
+#endif
@@ -3,7 +3,10 @@
 
 #include <string>
 #include <chrono>
+#include <cstdint>
+#include <ctime>
 #include <nlohmann/json.hpp>
+#include "utils.hpp"
 
 using json = nlohmann::json;
 
@@ -15,6 +18,8 @@ struct Order {
     double amount{};
     std::string description;
     std::string status;
+    // Bumped on every status change.
+    int version{};
     std::chrono::system_clock::time_point created_at{std::chrono::system_clock::now()};
 
     static Order from_json(const json& j) {
@@ -24,7 +29,16 @@ struct Order {
         o.amount = j.at("amount").get<double>();
         o.description = j.value("description", std::string{});
         o.status = j.at("status").get<std::string>();
-        o.created_at = std::chrono::system_clock::now();
+        o.version = j.value("version", 0);
+        if (j.contains("created_at_ms")) {
+            o.created_at = utils::from_epoch_ms(j.at("created_at_ms").get<std::int64_t>());
+        } else if (j.contains("created_at_rfc3339")) {
+            o.created_at = utils::string_to_time(j.at("created_at_rfc3339").get<std::string>());
+        } else if (j.contains("created_at") && j.at("created_at").is_number()) {
+            o.created_at = std::chrono::system_clock::from_time_t(j.at("created_at").get<std::time_t>());
+        } else {
+            o.created_at = std::chrono::system_clock::now();
+        }
         return o;
     }
 
@@ -35,7 +49,12 @@ struct Order {
             {"amount", amount},
             {"description", description},
             {"status", status},
-            {"created_at", std::chrono::system_clock::to_time_t(created_at)}
+            {"version", version},
+            // created_at stays in epoch seconds for existing clients; the other two carry
+            // the millisecond precision.
+            {"created_at", std::chrono::system_clock::to_time_t(created_at)},
+            {"created_at_ms", utils::epoch_ms(created_at)},
+            {"created_at_rfc3339", utils::time_to_string(created_at)}
         };
     }
 };
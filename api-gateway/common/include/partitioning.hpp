@@ -0,0 +1,185 @@
+#ifndef PARTITIONING_HPP
+#define PARTITIONING_HPP
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "database.hpp"
+
+// Daily range partitioning for append-mostly tables (outbox/inbox). Partitions are named
+// <table>_pYYYYMMDD and cover one day of the partition column.
+namespace partitioning {
+
+inline void install_functions(Database& db) {
+    db.execute(
+        "CREATE OR REPLACE FUNCTION ensure_daily_partitions(parent text, days_ahead int) "
+        "RETURNS void AS $$ "
+        "DECLARE d date; "
+        "BEGIN "
+        "   FOR d IN SELECT generate_series(current_date::timestamp, (current_date + days_ahead)::timestamp, "
+        "                                   interval '1 day')::date LOOP "
+        "       EXECUTE format('CREATE TABLE IF NOT EXISTS %I PARTITION OF %I FOR VALUES FROM (%L) TO (%L)', "
+        "                      parent || '_p' || to_char(d, 'YYYYMMDD'), parent, d, d + 1); "
+        "   END LOOP; "
+        "END; "
+        "$$ language 'plpgsql'"
+    );
+
+    // Partitions holding rows that match live_condition (e.g. undelivered events) are kept.
+    db.execute(
+        "CREATE OR REPLACE FUNCTION drop_expired_partitions(parent text, retention_days int, live_condition text) "
+        "RETURNS int AS $$ "
+        "DECLARE part record; has_live boolean; dropped int := 0; "
+        "BEGIN "
+        "   FOR part IN "
+        "       SELECT c.relname FROM pg_inherits i "
+        "       JOIN pg_class c ON c.oid = i.inhrelid "
+        "       JOIN pg_class p ON p.oid = i.inhparent "
+        "       WHERE p.relname = parent "
+        "         AND c.relname ~ ('^' || parent || '_p[0-9]{8}$') "
+        "         AND to_date(right(c.relname, 8), 'YYYYMMDD') < current_date - retention_days "
+        "   LOOP "
+        "       IF coalesce(live_condition, '') <> '' THEN "
+        "           EXECUTE format('SELECT EXISTS (SELECT 1 FROM %I WHERE %s)', part.relname, live_condition) "
+        "               INTO has_live; "
+        "           CONTINUE WHEN has_live; "
+        "       END IF; "
+        "       EXECUTE format('DROP TABLE %I', part.relname); "
+        "       dropped := dropped + 1; "
+        "   END LOOP; "
+        "   RETURN dropped; "
+        "END; "
+        "$$ language 'plpgsql'"
+    );
+}
+
+// Creates `table` partitioned by day on `column`. A plain table left by an older release is
+// renamed out of the way first, given any columns it lacks and converted to the current column
+// types (text round-trip; bytea takes the UTF-8 text), then attached as the partition for
+// everything before today. New columns must therefore be appended at the end of `columns`.
+inline void create_partitioned_table(Database& db,
+                                     const std::string& table,
+                                     const std::string& columns,
+                                     const std::string& column,
+                                     int days_ahead) {
+    db.execute(
+        "DO $$ "
+        "DECLARE idx record; "
+        "BEGIN "
+        "   IF EXISTS (SELECT 1 FROM pg_class WHERE relname = '" + table + "' AND relkind = 'r') THEN "
+        "       ALTER TABLE " + table + " RENAME TO " + table + "_legacy; "
+        "       FOR idx IN SELECT indexname FROM pg_indexes WHERE tablename = '" + table + "_legacy' LOOP "
+        "           EXECUTE format('ALTER INDEX %I RENAME TO %I', idx.indexname, idx.indexname || '_legacy'); "
+        "       END LOOP; "
+        "   END IF; "
+        "END $$"
+    );
+
+    db.execute(
+        "CREATE TABLE IF NOT EXISTS " + table + " (" + columns + ") "
+        "PARTITION BY RANGE (" + column + ")"
+    );
+
+    db.execute("SELECT ensure_daily_partitions($1, $2)", table, days_ahead);
+
+    db.execute(
+        "DO $$ "
+        "DECLARE old_name text := '" + table + "_p' || to_char(current_date - 1, 'YYYYMMDD'); col record; "
+        "BEGIN "
+        "   IF EXISTS (SELECT 1 FROM pg_class WHERE relname = '" + table + "_legacy' AND NOT relispartition) THEN "
+        "       FOR col IN "
+        "           SELECT a.attname, format_type(a.atttypid, a.atttypmod) AS type FROM pg_attribute a "
+        "           WHERE a.attrelid = '" + table + "'::regclass AND a.attnum > 0 AND NOT a.attisdropped "
+        "             AND NOT EXISTS (SELECT 1 FROM pg_attribute b WHERE b.attrelid = '" + table + "_legacy'::regclass "
+        "                             AND b.attname = a.attname AND NOT b.attisdropped) "
+        "           ORDER BY a.attnum "
+        "       LOOP "
+        "           EXECUTE format('ALTER TABLE %I ADD COLUMN %I %s', '" + table + "_legacy', col.attname, col.type); "
+        "       END LOOP; "
+        "       FOR col IN "
+        "           SELECT a.attname, format_type(a.atttypid, a.atttypmod) AS type FROM pg_attribute a "
+        "           JOIN pg_attribute b ON b.attrelid = '" + table + "_legacy'::regclass "
+        "                              AND b.attname = a.attname AND NOT b.attisdropped "
+        "           WHERE a.attrelid = '" + table + "'::regclass AND a.attnum > 0 AND NOT a.attisdropped "
+        "             AND b.atttypid <> a.atttypid "
+        "       LOOP "
+        "           EXECUTE format('ALTER TABLE %I ALTER COLUMN %I TYPE %s USING %s', '" + table + "_legacy', "
+        "                          col.attname, col.type, "
+        "                          CASE WHEN col.type = 'bytea' THEN format('convert_to(%I::text, ''UTF8'')', col.attname) "
+        "                               ELSE format('%I::text::%s', col.attname, col.type) END); "
+        "       END LOOP; "
+        "       INSERT INTO " + table + " SELECT * FROM " + table + "_legacy WHERE " + column + " >= current_date; "
+        "       DELETE FROM " + table + "_legacy WHERE " + column + " >= current_date; "
+        "       EXECUTE format('ALTER TABLE %I RENAME TO %I', '" + table + "_legacy', old_name); "
+        "       EXECUTE format('ALTER TABLE %I ATTACH PARTITION %I FOR VALUES FROM (MINVALUE) TO (%L)', "
+        "                      '" + table + "', old_name, current_date); "
+        "   END IF; "
+        "END $$"
+    );
+}
+
+}
+
+struct PartitionedTable {
+    std::string name;
+    // SQL predicate; partitions with matching rows survive retention.
+    std::string live_condition;
+};
+
+// Keeps partitions created ahead of time and drops the ones past retention.
+class PartitionMaintainer {
+public:
+    PartitionMaintainer(std::shared_ptr<Database> db,
+                        std::vector<PartitionedTable> tables,
+                        int retention_days,
+                        int days_ahead,
+                        std::chrono::seconds interval)
+        : db_(std::move(db)), tables_(std::move(tables)),
+          retention_days_(retention_days), days_ahead_(days_ahead), interval_(interval) {
+    }
+
+    void run_once() {
+        for (const auto& table : tables_) {
+            db_->execute("SELECT ensure_daily_partitions($1, $2)", table.name, days_ahead_);
+            auto dropped = db_->query("SELECT drop_expired_partitions($1, $2, $3)",
+                                      table.name, retention_days_, table.live_condition);
+            auto count = dropped[0][0].as<int>();
+            if (count > 0) {
+                std::cout << "Dropped " << count << " expired partition(s) of " << table.name << std::endl;
+            }
+        }
+    }
+
+    void run() {
+        while (running_.load()) {
+            try {
+                run_once();
+            } catch (const std::exception& e) {
+                std::cerr << "Partition maintenance error: " << e.what() << std::endl;
+            }
+
+            auto wake_at = std::chrono::steady_clock::now() + interval_;
+            while (running_.load() && std::chrono::steady_clock::now() < wake_at) {
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+            }
+        }
+    }
+
+    void stop() {
+        running_.store(false);
+    }
+
+private:
+    std::shared_ptr<Database> db_;
+    std::vector<PartitionedTable> tables_;
+    int retention_days_;
+    int days_ahead_;
+    std::chrono::seconds interval_;
+    std::atomic_bool running_{true};
+};
+
+#endif
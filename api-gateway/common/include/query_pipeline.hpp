@@ -0,0 +1,229 @@
+#ifndef QUERY_PIPELINE_HPP
+#define QUERY_PIPELINE_HPP
+
+#include <charconv>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <libpq-fe.h>
+
+// Runs a batch of statements in libpq pipeline mode (PostgreSQL 14+ client library): every
+// statement goes out before any result is read, so the batch costs about one round trip.
+// Parameters are bound by the server exactly as with exec_params, never spliced into the SQL.
+// libpqxx 6.4 has no pipeline mode and does not expose its connection handle, so the pipeline
+// keeps a libpq connection of its own. run() may be called from several threads; their
+// batches go out one after the other. Meant for a handful of statements with small results.
+class QueryPipeline {
+public:
+    // Sent in binary format, e.g. for a bytea parameter.
+    struct Binary {
+        std::string bytes;
+    };
+
+    class Batch {
+    public:
+        // atomic: the statements share one implicit transaction, so a failure rolls back the
+        // ones before it and skips the rest. Otherwise each statement commits on its own.
+        explicit Batch(bool atomic = false) : atomic_(atomic) {}
+
+        // Returns the index of the statement's entry in run()'s results.
+        template<typename... Args>
+        std::size_t add(std::string sql, const Args&... args) {
+            Statement statement{std::move(sql), {}};
+            (statement.params.push_back(param(args)), ...);
+            statements_.push_back(std::move(statement));
+            return statements_.size() - 1;
+        }
+
+        std::size_t size() const { return statements_.size(); }
+        bool empty() const { return statements_.empty(); }
+
+    private:
+        friend class QueryPipeline;
+
+        struct Param {
+            std::string value;
+            bool binary;
+        };
+
+        struct Statement {
+            std::string sql;
+            std::vector<Param> params;
+        };
+
+        static Param param(const std::string& value) { return {value, false}; }
+        static Param param(const char* value) { return {value, false}; }
+        static Param param(const Binary& value) { return {value.bytes, true}; }
+        static Param param(bool value) { return {value ? "true" : "false", false}; }
+
+        // Shortest text that reads back as the same value.
+        template<typename T, typename = std::enable_if_t<std::is_arithmetic<T>::value>>
+        static Param param(T value) {
+            char buffer[64];
+            auto end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+            return {std::string(buffer, end), false};
+        }
+
+        bool atomic_;
+        std::vector<Statement> statements_;
+    };
+
+    struct Result {
+        // Empty when the statement succeeded.
+        std::string error;
+        std::vector<std::string> columns;
+        std::vector<std::vector<std::optional<std::string>>> rows;
+
+        bool ok() const { return error.empty(); }
+
+        // Null fields are empty optionals; an unknown column throws.
+        const std::optional<std::string>& value(std::size_t row, const std::string& column) const {
+            for (std::size_t i = 0; i < columns.size(); ++i) {
+                if (columns[i] == column) return rows.at(row).at(i);
+            }
+            throw std::out_of_range("No column " + column + " in pipeline result");
+        }
+    };
+
+    explicit QueryPipeline(std::string conn_str) : conn_str_(std::move(conn_str)) {}
+    ~QueryPipeline() { drop(); }
+
+    QueryPipeline(const QueryPipeline&) = delete;
+    QueryPipeline& operator=(const QueryPipeline&) = delete;
+
+    // One result per statement, in order; a failed statement reports its error there. Throws
+    // only when the connection fails, in which case it is unknown which statements ran; the
+    // next run() reconnects.
+    std::vector<Result> run(const Batch& batch);
+
+private:
+    void connect();
+    void drop();
+    [[noreturn]] void fail(const std::string& what);
+    static Result to_result(const PGresult* res);
+
+    std::string conn_str_;
+    PGconn* conn_{nullptr};
+    std::mutex mutex_;
+};
+
+inline std::vector<QueryPipeline::Result> QueryPipeline::run(const Batch& batch) {
+    const auto& statements = batch.statements_;
+    std::vector<Result> results(statements.size());
+    if (statements.empty()) return results;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!conn_ || PQstatus(conn_) != CONNECTION_OK) connect();
+
+    auto syncs_after = [&](std::size_t i) { return !batch.atomic_ || i + 1 == statements.size(); };
+
+    for (std::size_t i = 0; i < statements.size(); ++i) {
+        const auto& statement = statements[i];
+        std::vector<const char*> values;
+        std::vector<int> lengths;
+        std::vector<int> formats;
+        for (const auto& p : statement.params) {
+            values.push_back(p.value.c_str());
+            lengths.push_back(static_cast<int>(p.value.size()));
+            formats.push_back(p.binary ? 1 : 0);
+        }
+
+        if (!PQsendQueryParams(conn_, statement.sql.c_str(), static_cast<int>(values.size()), nullptr,
+                               values.data(), lengths.data(), formats.data(), 0)) {
+            fail("send");
+        }
+        if (syncs_after(i) && !PQpipelineSync(conn_)) {
+            fail("sync");
+        }
+    }
+
+    // Each statement yields its result and then a null; each sync point yields a SYNC result.
+    for (std::size_t i = 0; i < statements.size(); ++i) {
+        PGresult* res = PQgetResult(conn_);
+        if (!res) fail("missing result");
+        results[i] = to_result(res);
+        PQclear(res);
+
+        res = PQgetResult(conn_);
+        if (res) {
+            PQclear(res);
+            fail("unexpected extra result");
+        }
+
+        if (syncs_after(i)) {
+            res = PQgetResult(conn_);
+            bool synced = res && PQresultStatus(res) == PGRES_PIPELINE_SYNC;
+            PQclear(res);
+            if (!synced) fail("missing sync");
+        }
+    }
+
+    return results;
+}
+
+inline void QueryPipeline::connect() {
+    drop();
+    conn_ = PQconnectdb(conn_str_.c_str());
+    if (PQstatus(conn_) != CONNECTION_OK) {
+        std::string error = PQerrorMessage(conn_);
+        drop();
+        throw std::runtime_error("Pipeline connection failed: " + error);
+    }
+    if (!PQenterPipelineMode(conn_)) {
+        drop();
+        throw std::runtime_error("Pipeline mode unavailable");
+    }
+}
+
+inline void QueryPipeline::drop() {
+    if (conn_) {
+        PQfinish(conn_);
+        conn_ = nullptr;
+    }
+}
+
+// The connection's protocol state is unknown after a failure, so it is not reused.
+inline void QueryPipeline::fail(const std::string& what) {
+    std::string error = conn_ ? PQerrorMessage(conn_) : "";
+    drop();
+    throw std::runtime_error("Pipeline " + what + " failed: " + error);
+}
+
+inline QueryPipeline::Result QueryPipeline::to_result(const PGresult* res) {
+    Result result;
+    switch (PQresultStatus(res)) {
+    case PGRES_TUPLES_OK:
+        for (int c = 0; c < PQnfields(res); ++c) {
+            result.columns.emplace_back(PQfname(res, c));
+        }
+        for (int r = 0; r < PQntuples(res); ++r) {
+            std::vector<std::optional<std::string>> row;
+            for (int c = 0; c < PQnfields(res); ++c) {
+                if (PQgetisnull(res, r, c)) {
+                    row.emplace_back();
+                } else {
+                    row.emplace_back(std::string(PQgetvalue(res, r, c), PQgetlength(res, r, c)));
+                }
+            }
+            result.rows.push_back(std::move(row));
+        }
+        break;
+    case PGRES_COMMAND_OK:
+        break;
+    case PGRES_PIPELINE_ABORTED:
+        result.error = "Skipped after an earlier statement in the batch failed";
+        break;
+    default:
+        result.error = PQresultErrorMessage(res);
+        while (!result.error.empty() && result.error.back() == '\n') result.error.pop_back();
+        if (result.error.empty()) result.error = PQresStatus(PQresultStatus(res));
+        break;
+    }
+    return result;
+}
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef RATE_LIMITER_HPP
+#define RATE_LIMITER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "utils.hpp"
+
+struct RateLimit {
+    // Sustained requests per second; 0 disables limiting for the route.
+    double rate{0};
+    // Requests allowed back to back after an idle period.
+    double burst{1};
+};
+
+// In-memory token buckets, one per (route, key). Each route's buckets are split across
+// independently locked shards by a hash of the key, so concurrent requests for different
+// users rarely contend. Routes are registered up front; acquire() never allocates for a
+// key it has seen recently.
+class RateLimiter {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Decision {
+        bool allowed;
+        // Time until the request would be admitted; zero when allowed.
+        std::chrono::milliseconds retry_after;
+    };
+
+    explicit RateLimiter(std::size_t shards = 64, std::size_t max_keys_per_shard = 4096)
+        : shard_count_(shards == 0 ? 1 : shards), max_keys_per_shard_(max_keys_per_shard) {}
+
+    // Not thread-safe; call before serving requests.
+    void set_limit(const std::string& route, RateLimit limit) {
+        routes_[route] = std::make_unique<Route>(limit, shard_count_);
+    }
+
+    Decision acquire(const std::string& route, const std::string& key, double cost = 1) {
+        auto it = routes_.find(route);
+        if (it == routes_.end() || it->second->limit.rate <= 0) {
+            return {true, std::chrono::milliseconds(0)};
+        }
+        auto& r = *it->second;
+        auto& shard = r.shards[utils::stable_hash(key) % r.shards.size()];
+        auto now = Clock::now();
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto bucket = shard.buckets.find(key);
+        if (bucket == shard.buckets.end()) {
+            if (shard.buckets.size() >= max_keys_per_shard_) {
+                evict_full(r, shard, now);
+            }
+            bucket = shard.buckets.emplace(key, Bucket{r.limit.burst, now}).first;
+        } else {
+            refill(r.limit, bucket->second, now);
+        }
+
+        if (bucket->second.tokens >= cost) {
+            bucket->second.tokens -= cost;
+            r.allowed.fetch_add(1, std::memory_order_relaxed);
+            return {true, std::chrono::milliseconds(0)};
+        }
+
+        r.rejected.fetch_add(1, std::memory_order_relaxed);
+        auto wait = (cost - bucket->second.tokens) / r.limit.rate;
+        return {false, std::chrono::milliseconds(static_cast<std::int64_t>(std::ceil(wait * 1000)))};
+    }
+
+    // {"<route>": {"rate", "burst", "allowed", "rejected", "tracked_keys"}, ...}
+    nlohmann::json stats() const {
+        auto result = nlohmann::json::object();
+        for (const auto& [name, route] : routes_) {
+            std::size_t keys = 0;
+            for (auto& shard : route->shards) {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                keys += shard.buckets.size();
+            }
+            result[name] = {
+                {"rate", route->limit.rate},
+                {"burst", route->limit.burst},
+                {"allowed", route->allowed.load(std::memory_order_relaxed)},
+                {"rejected", route->rejected.load(std::memory_order_relaxed)},
+                {"tracked_keys", keys}
+            };
+        }
+        return result;
+    }
+
+private:
+    struct Bucket {
+        double tokens;
+        Clock::time_point updated;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, Bucket> buckets;
+    };
+
+    struct Route {
+        Route(RateLimit l, std::size_t shard_count) : limit(l), shards(shard_count) {}
+
+        RateLimit limit;
+        std::vector<Shard> shards;
+        std::atomic<std::uint64_t> allowed{0};
+        std::atomic<std::uint64_t> rejected{0};
+    };
+
+    static void refill(const RateLimit& limit, Bucket& bucket, Clock::time_point now) {
+        std::chrono::duration<double> elapsed = now - bucket.updated;
+        bucket.tokens = std::min(limit.burst, bucket.tokens + elapsed.count() * limit.rate);
+        bucket.updated = now;
+    }
+
+    // A bucket that has refilled completely behaves exactly like a missing one, so dropping
+    // it loses nothing. If every key is active the table is allowed to grow past the cap.
+    static void evict_full(const Route& route, Shard& shard, Clock::time_point now) {
+        for (auto it = shard.buckets.begin(); it != shard.buckets.end();) {
+            std::chrono::duration<double> idle = now - it->second.updated;
+            if (it->second.tokens + idle.count() * route.limit.rate >= route.limit.burst) {
+                it = shard.buckets.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    std::size_t shard_count_;
+    std::size_t max_keys_per_shard_;
+    std::map<std::string, std::unique_ptr<Route>> routes_;
+};
+
+namespace rate_limit {
+
+// Reads a top-level-looking "field": "value" pair straight from a JSON body, so a request can
+// be keyed before it is parsed. Returns empty if the field is absent or its value is not a
+// plain string (escapes included); callers then fall back to another key.
+inline std::string peek_json_string(const std::string& body, const std::string& field) {
+    auto quoted = "\"" + field + "\"";
+    auto pos = body.find(quoted);
+    if (pos == std::string::npos) return {};
+    pos += quoted.size();
+
+    auto skip_space = [&]() {
+        while (pos < body.size() && (body[pos] == ' ' || body[pos] == '\t' || body[pos] == '\n' || body[pos] == '\r')) {
+            ++pos;
+        }
+    };
+    skip_space();
+    if (pos >= body.size() || body[pos] != ':') return {};
+    ++pos;
+    skip_space();
+    if (pos >= body.size() || body[pos] != '"') return {};
+    ++pos;
+
+    auto end = body.find_first_of("\"\\", pos);
+    if (end == std::string::npos || body[end] != '"') return {};
+    return body.substr(pos, end - pos);
+}
+
+}
+
+#endif
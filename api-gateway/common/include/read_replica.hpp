@@ -0,0 +1,178 @@
+#ifndef READ_REPLICA_HPP
+#define READ_REPLICA_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <pqxx/pqxx>
+
+// Read replica shared by every thread that reads through it. Each reader leases a connection
+// of its own, so reads run side by side; the mutex only covers the in-sync flag and the idle
+// connections. The replica is used while its replay lag, checked at most once per
+// lag_check_interval, stays within max_lag. One reader runs each check while the others keep
+// going on the previous verdict.
+class ReadReplica {
+public:
+    // A replica connection on loan; returned to the idle list when the lease ends.
+    class Lease {
+    public:
+        Lease() = default;
+        Lease(ReadReplica* owner, std::unique_ptr<pqxx::connection> conn)
+            : owner_(owner), conn_(std::move(conn)) {}
+        Lease(Lease&&) = default;
+        Lease& operator=(Lease&&) = delete;
+        ~Lease() {
+            if (owner_ && conn_) owner_->release(std::move(conn_));
+        }
+
+        explicit operator bool() const { return conn_ != nullptr; }
+        pqxx::connection& operator*() { return *conn_; }
+
+        // The connection broke: it is closed instead of returned, and the replica counts as
+        // out of sync until the next check.
+        void discard() {
+            conn_.reset();
+            if (owner_) owner_->mark_unavailable();
+        }
+
+    private:
+        ReadReplica* owner_{nullptr};
+        std::unique_ptr<pqxx::connection> conn_;
+    };
+
+    ReadReplica(std::string conn_str, std::chrono::milliseconds max_lag,
+                std::chrono::milliseconds lag_check_interval, std::size_t max_idle = 8)
+        : conn_str_(std::move(conn_str)), max_lag_(max_lag),
+          lag_check_interval_(lag_check_interval), max_idle_(max_idle) {}
+
+    ReadReplica(const ReadReplica&) = delete;
+    ReadReplica& operator=(const ReadReplica&) = delete;
+
+    // An empty lease means the replica is lagging or unreachable; read from the primary.
+    Lease acquire();
+
+private:
+    void release(std::unique_ptr<pqxx::connection> conn);
+    void mark_unavailable();
+    bool lag_within_limit(pqxx::connection& conn);
+
+    std::string conn_str_;
+    std::chrono::milliseconds max_lag_;
+    std::chrono::milliseconds lag_check_interval_;
+    std::size_t max_idle_;
+
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<pqxx::connection>> idle_;
+    std::chrono::steady_clock::time_point checked_at_{};
+    bool checking_{false};
+    bool in_sync_{false};
+    // Whether the last check reached the server; only used to keep the log quiet.
+    bool reachable_{false};
+};
+
+inline ReadReplica::Lease ReadReplica::acquire() {
+    std::unique_ptr<pqxx::connection> conn;
+    bool check = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto now = std::chrono::steady_clock::now();
+        if (!checking_ && (checked_at_ == std::chrono::steady_clock::time_point{} ||
+                           now - checked_at_ >= lag_check_interval_)) {
+            checking_ = true;
+            checked_at_ = now;
+            check = true;
+        } else if (!in_sync_) {
+            return {};
+        }
+        if (!idle_.empty()) {
+            conn = std::move(idle_.back());
+            idle_.pop_back();
+        }
+    }
+
+    // Connecting and checking happen outside the lock, so an unreachable host (see
+    // connect_timeout) stalls only the reader that ran into it.
+    bool in_sync = true;
+    try {
+        if (!conn) conn = std::make_unique<pqxx::connection>(conn_str_);
+        if (check) in_sync = lag_within_limit(*conn);
+    } catch (const std::exception& e) {
+        bool was_reachable;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            was_reachable = reachable_ || in_sync_;
+            reachable_ = false;
+            in_sync_ = false;
+            idle_.clear();
+            if (check) checking_ = false;
+        }
+        if (was_reachable) {
+            std::cerr << "Read replica unavailable, using primary: " << e.what() << std::endl;
+        }
+        return {};
+    }
+
+    if (check) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        reachable_ = true;
+        in_sync_ = in_sync;
+        checking_ = false;
+        if (!in_sync) {
+            if (idle_.size() < max_idle_) idle_.push_back(std::move(conn));
+            return {};
+        }
+    }
+    return Lease(this, std::move(conn));
+}
+
+inline void ReadReplica::release(std::unique_ptr<pqxx::connection> conn) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (idle_.size() < max_idle_) idle_.push_back(std::move(conn));
+}
+
+inline void ReadReplica::mark_unavailable() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    in_sync_ = false;
+    // They share the fate of the one that broke.
+    idle_.clear();
+}
+
+// Called without the lock; logs when the verdict changes.
+inline bool ReadReplica::lag_within_limit(pqxx::connection& conn) {
+    // Nothing waiting to be replayed counts as no lag, so an idle primary does not make
+    // the replica look stale. A server that is not in recovery reports no lag either. The
+    // equal-LSN shortcut only holds while the WAL receiver is streaming; a disconnected
+    // replica has nothing to replay but can be arbitrarily behind, so it reports NULL.
+    pqxx::nontransaction nt(conn);
+    auto lag = nt.exec(
+        "SELECT CASE "
+        "   WHEN NOT pg_is_in_recovery() THEN 0 "
+        "   WHEN NOT EXISTS (SELECT 1 FROM pg_stat_wal_receiver WHERE status = 'streaming') THEN NULL "
+        "   WHEN pg_last_wal_receive_lsn() = pg_last_wal_replay_lsn() THEN 0 "
+        "   ELSE coalesce(extract(epoch FROM now() - pg_last_xact_replay_timestamp()) * 1000, 0) "
+        "END");
+    bool streaming = !lag[0][0].is_null();
+    auto lag_ms = streaming ? lag[0][0].as<double>() : 0.0;
+    bool in_sync = streaming && lag_ms <= static_cast<double>(max_lag_.count());
+
+    bool was_in_sync;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        was_in_sync = in_sync_;
+    }
+    if (in_sync != was_in_sync) {
+        if (streaming) {
+            std::cerr << "Read replica " << (in_sync ? "in sync" : "lagging") << " (" << lag_ms << " ms)" << std::endl;
+        } else {
+            std::cerr << "Read replica lagging (WAL receiver not streaming)" << std::endl;
+        }
+    }
+    return in_sync;
+}
+
+#endif
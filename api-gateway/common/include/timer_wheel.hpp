@@ -0,0 +1,72 @@
+#ifndef TIMER_WHEEL_HPP
+#define TIMER_WHEEL_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Hashed timer wheel: a ring of slots, one per tick, so scheduling and expiring are O(1) per
+// item however many are waiting. Items further out than one revolution carry the number of
+// extra revolutions to wait. Not thread-safe; the owner serialises access.
+template<typename T>
+class TimerWheel {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    TimerWheel(Clock::duration tick, std::size_t slots, Clock::time_point start = Clock::now())
+        : tick_(tick), slots_(slots == 0 ? 1 : slots), cursor_time_(start) {}
+
+    // Fires on the first tick at or after due (never on the current one).
+    void schedule(T item, Clock::time_point due) {
+        long long ticks = 1;
+        if (due > cursor_time_) {
+            ticks = (due - cursor_time_ + tick_ - Clock::duration(1)) / tick_;
+            if (ticks < 1) ticks = 1;
+        }
+        auto offset = static_cast<std::size_t>(ticks);
+        auto& slot = slots_[(cursor_ + offset) % slots_.size()];
+        slot.push_back(Entry{(offset - 1) / slots_.size(), std::move(item)});
+        ++size_;
+    }
+
+    // Turns the wheel up to now and returns every item that came due on the way.
+    std::vector<T> advance(Clock::time_point now) {
+        std::vector<T> due;
+        while (cursor_time_ + tick_ <= now) {
+            cursor_time_ += tick_;
+            cursor_ = (cursor_ + 1) % slots_.size();
+
+            auto& slot = slots_[cursor_];
+            std::size_t kept = 0;
+            for (std::size_t i = 0; i < slot.size(); ++i) {
+                if (slot[i].rounds == 0) {
+                    due.push_back(std::move(slot[i].item));
+                    --size_;
+                    continue;
+                }
+                --slot[i].rounds;
+                if (kept != i) slot[kept] = std::move(slot[i]);
+                ++kept;
+            }
+            slot.erase(slot.begin() + static_cast<std::ptrdiff_t>(kept), slot.end());
+        }
+        return due;
+    }
+
+    std::size_t size() const { return size_; }
+
+private:
+    struct Entry {
+        std::size_t rounds;
+        T item;
+    };
+
+    Clock::duration tick_;
+    std::vector<std::vector<Entry>> slots_;
+    std::size_t cursor_{0};
+    Clock::time_point cursor_time_;
+    std::size_t size_{0};
+};
+
+#endif
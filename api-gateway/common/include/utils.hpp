@@ -3,16 +3,18 @@
 
 #include <string>
 #include <chrono>
-#include <iomanip>
 #include <sstream>
 #include <random>
-#include <ctime>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
 
 namespace utils {
 
 inline std::string generate_uuid() {
-    std::random_device rd;
-    std::mt19937 gen(rd());
+    // Seeding from random_device costs a syscall; do it once per thread, not per UUID.
+    thread_local std::mt19937 gen(std::random_device{}());
     std::uniform_int_distribution<> dis(0, 15);
     std::uniform_int_distribution<> dis2(8, 11);
 
@@ -27,18 +29,187 @@ inline std::string generate_uuid() {
     return ss.str();
 }
 
+// FNV-1a: unlike std::hash it is identical across processes and services,
+// so it can be used for routing and shard decisions shared between them.
+inline std::uint64_t stable_hash(const std::string& key) {
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Timestamps travel as UTC: RFC 3339 with milliseconds ("2024-05-01T12:34:56.789Z") or epoch
+// milliseconds. Both directions use plain integer arithmetic on the proleptic Gregorian
+// calendar, so there is no locale, time zone database or shared static buffer involved.
+
+inline std::int64_t epoch_ms(std::chrono::system_clock::time_point tp) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(tp.time_since_epoch()).count();
+}
+
+inline std::chrono::system_clock::time_point from_epoch_ms(std::int64_t ms) {
+    return std::chrono::system_clock::time_point(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::milliseconds(ms)));
+}
+
+// Days since 1970-01-01 <-> civil date (H. Hinnant's algorithms).
+inline std::int64_t days_from_civil(std::int64_t y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    const std::int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = static_cast<unsigned>(y - era * 400);
+    const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<std::int64_t>(doe) - 719468;
+}
+
+inline void civil_from_days(std::int64_t z, std::int64_t& y, unsigned& m, unsigned& d) {
+    z += 719468;
+    const std::int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    const unsigned doe = static_cast<unsigned>(z - era * 146097);
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    d = doy - (153 * mp + 2) / 5 + 1;
+    m = mp < 10 ? mp + 3 : mp - 9;
+    y = static_cast<std::int64_t>(yoe) + era * 400 + (m <= 2);
+}
+
+// "YYYY-MM-DDTHH:MM:SS.mmmZ", without a terminating NUL.
+constexpr std::size_t rfc3339_size = 24;
+
+// Writes exactly rfc3339_size chars to out. The "YYYY-MM-DDT" prefix is cached per thread,
+// since consecutive timestamps almost always fall on the same day.
+inline void format_rfc3339(std::chrono::system_clock::time_point tp, char* out) {
+    constexpr std::int64_t ms_per_day = 86400000;
+    auto ms = epoch_ms(tp);
+    auto days = ms / ms_per_day;
+    auto ms_of_day = ms % ms_per_day;
+    if (ms_of_day < 0) {
+        ms_of_day += ms_per_day;
+        --days;
+    }
+
+    struct DayPrefix {
+        std::int64_t days{INT64_MIN};
+        char text[11];
+    };
+    thread_local DayPrefix cached;
+    if (cached.days != days) {
+        std::int64_t y;
+        unsigned m, d;
+        civil_from_days(days, y, m, d);
+        auto year = static_cast<unsigned>(y < 0 ? 0 : (y > 9999 ? 9999 : y));
+        cached.text[0] = static_cast<char>('0' + year / 1000);
+        cached.text[1] = static_cast<char>('0' + year / 100 % 10);
+        cached.text[2] = static_cast<char>('0' + year / 10 % 10);
+        cached.text[3] = static_cast<char>('0' + year % 10);
+        cached.text[4] = '-';
+        cached.text[5] = static_cast<char>('0' + m / 10);
+        cached.text[6] = static_cast<char>('0' + m % 10);
+        cached.text[7] = '-';
+        cached.text[8] = static_cast<char>('0' + d / 10);
+        cached.text[9] = static_cast<char>('0' + d % 10);
+        cached.text[10] = 'T';
+        cached.days = days;
+    }
+    std::memcpy(out, cached.text, sizeof(cached.text));
+
+    auto two = [](char* p, unsigned v) {
+        p[0] = static_cast<char>('0' + v / 10);
+        p[1] = static_cast<char>('0' + v % 10);
+    };
+    auto secs = static_cast<unsigned>(ms_of_day / 1000);
+    auto millis = static_cast<unsigned>(ms_of_day % 1000);
+    two(out + 11, secs / 3600);
+    out[13] = ':';
+    two(out + 14, secs / 60 % 60);
+    out[16] = ':';
+    two(out + 17, secs % 60);
+    out[19] = '.';
+    out[20] = static_cast<char>('0' + millis / 100);
+    two(out + 21, millis % 100);
+    out[23] = 'Z';
+}
+
 inline std::string time_to_string(const std::chrono::system_clock::time_point& tp) {
-    auto t = std::chrono::system_clock::to_time_t(tp);
-    std::stringstream ss;
-    ss << std::put_time(std::localtime(&t), "%Y-%m-%d %H:%M:%S");
-    return ss.str();
+    char buffer[rfc3339_size];
+    format_rfc3339(tp, buffer);
+    return std::string(buffer, rfc3339_size);
+}
+
+// Accepts RFC 3339 and the Postgres text forms: "T" or " " between date and time, any number
+// of fraction digits (kept to the millisecond), and "Z", "+HH", "+HH:MM" or "+HHMM" as the
+// offset. Without an offset the time is taken as UTC. Returns false on malformed input.
+inline bool parse_rfc3339(const char* s, std::size_t n, std::chrono::system_clock::time_point& out) {
+    std::size_t pos = 0;
+    auto digits = [&](std::size_t count, unsigned& value) {
+        if (n - pos < count) return false;
+        value = 0;
+        for (std::size_t i = 0; i < count; ++i) {
+            char c = s[pos + i];
+            if (c < '0' || c > '9') return false;
+            value = value * 10 + static_cast<unsigned>(c - '0');
+        }
+        pos += count;
+        return true;
+    };
+    auto literal = [&](char c) {
+        if (pos < n && s[pos] == c) {
+            ++pos;
+            return true;
+        }
+        return false;
+    };
+
+    unsigned year, month, day, hour, minute, second;
+    if (!digits(4, year) || !literal('-') || !digits(2, month) || !literal('-') || !digits(2, day)) return false;
+    if (!(literal('T') || literal('t') || literal(' '))) return false;
+    if (!digits(2, hour) || !literal(':') || !digits(2, minute) || !literal(':') || !digits(2, second)) return false;
+    if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60) return false;
+
+    unsigned millis = 0;
+    if (literal('.')) {
+        std::size_t start = pos;
+        unsigned scale = 100;
+        while (pos < n && s[pos] >= '0' && s[pos] <= '9') {
+            millis += static_cast<unsigned>(s[pos] - '0') * scale;
+            scale /= 10;
+            ++pos;
+        }
+        if (pos == start) return false;
+    }
+
+    std::int64_t offset_minutes = 0;
+    if (literal('Z') || literal('z')) {
+        // UTC
+    } else if (pos < n && (s[pos] == '+' || s[pos] == '-')) {
+        int sign = s[pos] == '-' ? -1 : 1;
+        ++pos;
+        unsigned oh, om = 0;
+        if (!digits(2, oh)) return false;
+        if (literal(':')) {
+            if (!digits(2, om)) return false;
+        } else if (pos < n) {
+            if (!digits(2, om)) return false;
+        }
+        offset_minutes = sign * static_cast<std::int64_t>(oh * 60 + om);
+    }
+    if (pos != n) return false;
+
+    auto days = days_from_civil(year, month, day);
+    auto ms = ((days * 24 + hour) * 60 + minute) * 60000 + static_cast<std::int64_t>(second) * 1000
+              + millis - offset_minutes * 60000;
+    out = from_epoch_ms(ms);
+    return true;
 }
 
 inline std::chrono::system_clock::time_point string_to_time(const std::string& str) {
-    std::tm tm = {};
-    std::stringstream ss(str);
-    ss >> std::get_time(&tm, "%Y-%m-%d %H:%M:%S");
-    return std::chrono::system_clock::from_time_t(std::mktime(&tm));
+    std::chrono::system_clock::time_point tp;
+    if (!parse_rfc3339(str.data(), str.size(), tp)) {
+        throw std::runtime_error("Invalid timestamp: " + str);
+    }
+    return tp;
 }
 
 }
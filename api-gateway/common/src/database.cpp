@@ -1,16 +1,24 @@
 #include "database.hpp"
 #include <stdexcept>
 
+static std::string connection_string(const std::string& host,
+                                     const std::string& port,
+                                     const std::string& dbname,
+                                     const std::string& user,
+                                     const std::string& password) {
+    return "host=" + host +
+           " port=" + port +
+           " dbname=" + dbname +
+           " user=" + user +
+           " password=" + password;
+}
+
 Database::Database(const std::string& host,
                    const std::string& port,
                    const std::string& dbname,
                    const std::string& user,
                    const std::string& password) {
-    std::string conn_str = "host=" + host +
-                          " port=" + port +
-                          " dbname=" + dbname +
-                          " user=" + user +
-                          " password=" + password;
+    auto conn_str = connection_string(host, port, dbname, user, password);
     try {
         conn_ = std::make_unique<pqxx::connection>(conn_str);
     } catch (const std::exception& e) {
@@ -23,6 +31,46 @@ pqxx::transaction_base& Database::begin_transaction() {
     return *transaction_;
 }
 
+namespace {
+
+class NotificationHandler : public pqxx::notification_receiver {
+public:
+    NotificationHandler(pqxx::connection& conn, const std::string& channel,
+                        std::function<void(const std::string&)> handler)
+        : pqxx::notification_receiver(conn, channel), handler_(std::move(handler)) {}
+
+    void operator()(const std::string& payload, int) override {
+        handler_(payload);
+    }
+
+private:
+    std::function<void(const std::string&)> handler_;
+};
+
+}
+
+void Database::listen(const std::string& channel, std::function<void(const std::string&)> handler) {
+    receivers_.push_back(std::make_unique<NotificationHandler>(*conn_, channel, std::move(handler)));
+}
+
+int Database::wait_for_notifications(std::chrono::milliseconds timeout) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(timeout).count();
+    return conn_->await_notification(static_cast<long>(us / 1000000), static_cast<long>(us % 1000000));
+}
+
+void Database::attach_replica(const std::string& host,
+                              const std::string& port,
+                              const std::string& dbname,
+                              const std::string& user,
+                              const std::string& password,
+                              std::chrono::milliseconds max_lag,
+                              std::chrono::milliseconds lag_check_interval) {
+    // An unreachable host must not stall readers for long.
+    replica_ = std::make_shared<ReadReplica>(
+        connection_string(host, port, dbname, user, password) + " connect_timeout=2",
+        max_lag, lag_check_interval);
+}
+
 pqxx::result Database::query(const std::string& sql) {
     pqxx::nontransaction nt(*conn_);
     return nt.exec(sql);
@@ -42,5 +90,31 @@ void Database::execute(pqxx::transaction_base& tx, const std::string& sql) {
     tx.exec(sql);
 }
 
+std::string Database::array_literal(const std::vector<std::string>& values) {
+    std::string literal = "{";
+    for (const auto& value : values) {
+        if (literal.size() > 1) literal.push_back(',');
+        literal.push_back('"');
+        for (char c : value) {
+            if (c == '"' || c == '\\') literal.push_back('\\');
+            literal.push_back(c);
+        }
+        literal.push_back('"');
+    }
+    literal.push_back('}');
+    return literal;
+}
+
+std::string Database::bytea_hex(const std::string& bytes) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex = "\\x";
+    hex.reserve(2 + bytes.size() * 2);
+    for (unsigned char c : bytes) {
+        hex.push_back(digits[c >> 4]);
+        hex.push_back(digits[c & 0x0f]);
+    }
+    return hex;
+}
+
 void Database::initialize_schema() {
 }
@@ -0,0 +1,57 @@
+#ifndef GROUP_COMMITTER_HPP
+#define GROUP_COMMITTER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "models.hpp"
+
+struct GroupCommitConfig {
+    std::size_t max_batch{64};
+    // How long the first order of a batch waits for others to join it.
+    std::chrono::microseconds window{1000};
+};
+
+// Collects concurrently created orders into one transaction so they share a single commit
+// (and fsync). submit() returns only after the shared commit, so each caller's durability
+// is the same as committing alone.
+class GroupCommitter {
+public:
+    // Writes and commits the given orders in one transaction; throws if nothing was committed.
+    using CommitBatch = std::function<void(const std::vector<models::Order>&)>;
+
+    GroupCommitter(GroupCommitConfig config, CommitBatch commit_batch);
+    ~GroupCommitter();
+
+    GroupCommitter(const GroupCommitter&) = delete;
+    GroupCommitter& operator=(const GroupCommitter&) = delete;
+
+    // Blocks until the order is committed; rethrows the commit error otherwise.
+    void submit(const models::Order& order);
+
+private:
+    struct Pending {
+        models::Order order;
+        std::promise<void> committed;
+    };
+
+    void run();
+    void commit(std::vector<Pending>& batch);
+
+    GroupCommitConfig config_;
+    CommitBatch commit_batch_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Pending> pending_;
+    bool stopping_{false};
+    std::thread worker_;
+};
+
+#endif
@@ -3,6 +3,9 @@
 
 #include <string>
 #include <functional>
+#include <chrono>
+#include <cstdint>
+#include <vector>
 #include <amqp.h>
 
 struct MessageQueueConfig {
@@ -12,14 +15,35 @@ struct MessageQueueConfig {
     std::string password;
 };
 
+struct Delivery {
+    // One entry per event; several when the message was a batch envelope, which is acked as a whole.
+    std::vector<std::string> events;
+    std::string content_type;
+    std::uint64_t delivery_tag{};
+    bool redelivered{};
+};
+
 class MessageQueue {
 public:
     explicit MessageQueue(const MessageQueueConfig& config);
     ~MessageQueue();
 
-    void publish(const std::string& queue, const std::string& message);
+    // batch marks message as an envelope built with event_batch::append.
+    void publish(const std::string& queue, const std::string& message,
+                 const std::string& content_type = "application/json", bool batch = false);
     void consume(const std::string& queue, std::function<void(const std::string&)> callback);
 
+    // Durable queue bound to a topic exchange, consumed with manual acks and the given prefetch.
+    void start_consuming_exchange(const std::string& exchange, const std::string& queue,
+                                  const std::string& binding_key, std::uint16_t prefetch);
+
+    // Returns false when nothing arrived within timeout.
+    bool next_delivery(Delivery& delivery, std::chrono::milliseconds timeout);
+
+    // Acknowledge or reject every unacknowledged delivery up to and including delivery_tag.
+    void ack_up_to(std::uint64_t delivery_tag);
+    void nack_up_to(std::uint64_t delivery_tag, bool requeue);
+
 private:
     amqp_connection_state_t connection_{};
     amqp_channel_t channel_{1};
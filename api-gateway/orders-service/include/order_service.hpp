@@ -1,26 +1,54 @@
 #ifndef ORDER_SERVICE_HPP
 #define ORDER_SERVICE_HPP
 
+#include <functional>
 #include <memory>
 #include <vector>
 #include <string>
 #include "database.hpp"
+#include "database_pool.hpp"
 #include "message_queue.hpp"
 #include "models.hpp"
+#include "event_codec.hpp"
+#include "group_committer.hpp"
+
+struct OrderRequest {
+    std::string user_id;
+    double amount{};
+    std::string description;
+};
 
 class OrderService {
 public:
-    OrderService(std::shared_ptr<Database> db, const MessageQueueConfig& mq_config);
+    // Each call leases its own connection from db, so the service may be used from many threads.
+    OrderService(std::shared_ptr<DatabasePool> db, const MessageQueueConfig& mq_config,
+                 event_codec::Encoding event_encoding = event_codec::Encoding::json);
+
+    // Opt-in: create_order then joins a shared transaction on commit_db instead of committing alone.
+    void enable_group_commit(std::shared_ptr<Database> commit_db, GroupCommitConfig config);
 
     models::Order create_order(const std::string& user_id, double amount, const std::string& description);
+    // Creates all orders and their payment requests in one transaction, streamed with COPY.
+    std::vector<models::Order> create_orders(const std::vector<OrderRequest>& requests);
     std::vector<models::Order> get_user_orders(const std::string& user_id);
-    models::Order get_order(const std::string& order_id);
+    // from_primary skips the read replica, for callers that must see a change they were told about.
+    models::Order get_order(const std::string& order_id, bool from_primary = false);
     void update_order_status(const std::string& order_id, const std::string& status);
 
+    // Called with the order ID after update_order_status commits.
+    void on_status_change(std::function<void(const std::string&)> listener);
+
 private:
-    std::shared_ptr<Database> db_;
+    // Streams the orders and their payment requests into tx with COPY.
+    void write_orders(pqxx::transaction_base& tx, const std::vector<models::Order>& orders);
+
+    std::shared_ptr<DatabasePool> db_;
     MessageQueueConfig mq_config_;
+    event_codec::Encoding event_encoding_;
     std::unique_ptr<MessageQueue> message_queue_;
+    std::shared_ptr<Database> commit_db_;
+    std::unique_ptr<GroupCommitter> group_committer_;
+    std::function<void(const std::string&)> status_listener_;
 };
 
 #endif
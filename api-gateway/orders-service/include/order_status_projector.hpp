@@ -0,0 +1,43 @@
+#ifndef ORDER_STATUS_PROJECTOR_HPP
+#define ORDER_STATUS_PROJECTOR_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include "database.hpp"
+#include "message_queue.hpp"
+
+struct OrderStatusProjectorConfig {
+    std::string exchange{"payment.results"};
+    std::string queue{"orders.payment_results"};
+    // Also the consumer prefetch; clamped to 1..65535.
+    std::size_t batch_size{100};
+    std::chrono::milliseconds batch_wait{50};
+};
+
+// Applies payment.results to orders.status in batches. Only NEW orders are moved,
+// so redelivered or duplicate results leave the row untouched.
+class OrderStatusProjector {
+public:
+    OrderStatusProjector(std::shared_ptr<Database> db, const MessageQueueConfig& mq_config,
+                         OrderStatusProjectorConfig config = {});
+    void run();
+    void stop();
+
+private:
+    void connect();
+    void collect_batch(std::vector<Delivery>& batch);
+    void apply_batch(const std::vector<Delivery>& batch);
+
+    std::shared_ptr<Database> db_;
+    MessageQueueConfig mq_config_;
+    OrderStatusProjectorConfig config_;
+    // Null until run() connects, and again after the connection fails.
+    std::unique_ptr<MessageQueue> message_queue_;
+    std::atomic_bool running_{true};
+};
+
+#endif
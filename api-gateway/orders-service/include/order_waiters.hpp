@@ -0,0 +1,80 @@
+#ifndef ORDER_WAITERS_HPP
+#define ORDER_WAITERS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "database.hpp"
+
+// Parks long-poll requests per order ID until notify() reports a status change for it.
+class OrderWaiters {
+    struct Entry {
+        std::condition_variable changed;
+        std::uint64_t generation{0};
+        std::size_t tickets{0};
+    };
+
+public:
+    class Ticket {
+    public:
+        ~Ticket();
+
+        Ticket(const Ticket&) = delete;
+        Ticket& operator=(const Ticket&) = delete;
+
+    private:
+        friend class OrderWaiters;
+
+        Ticket(OrderWaiters& waiters, std::string order_id, Entry* entry, std::uint64_t generation)
+            : waiters_(waiters), order_id_(std::move(order_id)), entry_(entry), generation_(generation) {}
+
+        OrderWaiters& waiters_;
+        std::string order_id_;
+        Entry* entry_;
+        std::uint64_t generation_;
+    };
+
+    explicit OrderWaiters(std::size_t max_waiters) : max_waiters_(max_waiters) {}
+
+    // Registers interest before the caller reads the current status, so a change that lands
+    // between that read and wait() still wakes it. Null when max_waiters are already parked.
+    std::unique_ptr<Ticket> watch(const std::string& order_id);
+
+    // True when the order was notified since watch() or the previous wake-up; false on timeout.
+    bool wait(Ticket& ticket, std::chrono::milliseconds timeout);
+
+    void notify(const std::string& order_id);
+
+private:
+    void release(Ticket& ticket);
+
+    std::size_t max_waiters_;
+    std::size_t waiting_{0};
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::unique_ptr<Entry>> entries_;
+};
+
+// Feeds NOTIFYs on channel order_status (raised by a trigger on orders) into the waiters, so
+// a status change made by any process wakes the requests parked here. Reconnects on error.
+class OrderStatusListener {
+public:
+    using DatabaseFactory = std::function<std::shared_ptr<Database>()>;
+
+    OrderStatusListener(DatabaseFactory connect_db, OrderWaiters& waiters);
+    void run();
+    void stop();
+
+private:
+    DatabaseFactory connect_db_;
+    OrderWaiters& waiters_;
+    std::atomic_bool running_{true};
+};
+
+#endif
@@ -1,16 +1,25 @@
 #include "database.hpp"
+#include "partitioning.hpp"
 #include <stdexcept>
 
+static std::string connection_string(const std::string& host,
+                                     const std::string& port,
+                                     const std::string& dbname,
+                                     const std::string& user,
+                                     const std::string& password) {
+    return "host=" + host +
+           " port=" + port +
+           " dbname=" + dbname +
+           " user=" + user +
+           " password=" + password;
+}
+
 Database::Database(const std::string& host,
                    const std::string& port,
                    const std::string& dbname,
                    const std::string& user,
                    const std::string& password) {
-    std::string conn_str = "host=" + host +
-                          " port=" + port +
-                          " dbname=" + dbname +
-                          " user=" + user +
-                          " password=" + password;
+    auto conn_str = connection_string(host, port, dbname, user, password);
     try {
         conn_ = std::make_unique<pqxx::connection>(conn_str);
     } catch (const std::exception& e) {
@@ -23,6 +32,46 @@ pqxx::transaction_base& Database::begin_transaction() {
     return *transaction_;
 }
 
+namespace {
+
+class NotificationHandler : public pqxx::notification_receiver {
+public:
+    NotificationHandler(pqxx::connection& conn, const std::string& channel,
+                        std::function<void(const std::string&)> handler)
+        : pqxx::notification_receiver(conn, channel), handler_(std::move(handler)) {}
+
+    void operator()(const std::string& payload, int) override {
+        handler_(payload);
+    }
+
+private:
+    std::function<void(const std::string&)> handler_;
+};
+
+}
+
+void Database::listen(const std::string& channel, std::function<void(const std::string&)> handler) {
+    receivers_.push_back(std::make_unique<NotificationHandler>(*conn_, channel, std::move(handler)));
+}
+
+int Database::wait_for_notifications(std::chrono::milliseconds timeout) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(timeout).count();
+    return conn_->await_notification(static_cast<long>(us / 1000000), static_cast<long>(us % 1000000));
+}
+
+void Database::attach_replica(const std::string& host,
+                              const std::string& port,
+                              const std::string& dbname,
+                              const std::string& user,
+                              const std::string& password,
+                              std::chrono::milliseconds max_lag,
+                              std::chrono::milliseconds lag_check_interval) {
+    // An unreachable host must not stall readers for long.
+    replica_ = std::make_shared<ReadReplica>(
+        connection_string(host, port, dbname, user, password) + " connect_timeout=2",
+        max_lag, lag_check_interval);
+}
+
 pqxx::result Database::query(const std::string& sql) {
     pqxx::nontransaction nt(*conn_);
     return nt.exec(sql);
@@ -42,6 +91,48 @@ void Database::execute(pqxx::transaction_base& tx, const std::string& sql) {
     tx.exec(sql);
 }
 
+std::string Database::array_literal(const std::vector<std::string>& values) {
+    std::string literal = "{";
+    for (const auto& value : values) {
+        if (literal.size() > 1) literal.push_back(',');
+        literal.push_back('"');
+        for (char c : value) {
+            if (c == '"' || c == '\\') literal.push_back('\\');
+            literal.push_back(c);
+        }
+        literal.push_back('"');
+    }
+    literal.push_back('}');
+    return literal;
+}
+
+// Event payloads used to be JSONB; they are bytea now so binary encodings fit. Existing rows
+// keep their JSON text and are tagged application/json by the content_type default.
+static void migrate_payload_to_bytea(Database& db, const std::string& table) {
+    db.execute(
+        "DO $$ "
+        "BEGIN "
+        "   IF EXISTS (SELECT 1 FROM information_schema.columns "
+        "              WHERE table_name = '" + table + "' AND column_name = 'payload' AND data_type = 'jsonb') THEN "
+        "       ALTER TABLE " + table + " ALTER COLUMN payload TYPE BYTEA USING convert_to(payload::text, 'UTF8'); "
+        "   END IF; "
+        "END $$"
+    );
+    db.execute("ALTER TABLE " + table + " ADD COLUMN IF NOT EXISTS content_type VARCHAR(100) "
+               "NOT NULL DEFAULT 'application/json'");
+}
+
+std::string Database::bytea_hex(const std::string& bytes) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex = "\\x";
+    hex.reserve(2 + bytes.size() * 2);
+    for (unsigned char c : bytes) {
+        hex.push_back(digits[c >> 4]);
+        hex.push_back(digits[c & 0x0f]);
+    }
+    return hex;
+}
+
 void Database::initialize_schema() {
     execute(
         "CREATE TABLE IF NOT EXISTS orders ("
@@ -50,17 +141,52 @@ void Database::initialize_schema() {
         "   amount DECIMAL(10,2) NOT NULL,"
         "   description TEXT,"
         "   status VARCHAR(50) NOT NULL,"
+        "   version INTEGER NOT NULL DEFAULT 0,"
         "   created_at TIMESTAMP NOT NULL"
         ")"
     );
+    execute("ALTER TABLE orders ADD COLUMN IF NOT EXISTS version INTEGER NOT NULL DEFAULT 0");
 
+    // Wakes long-polling requests on every replica (see OrderStatusListener), whichever
+    // process changed the status.
     execute(
-        "CREATE TABLE IF NOT EXISTS outbox_events ("
-        "   id VARCHAR(255) PRIMARY KEY,"
+        "CREATE OR REPLACE FUNCTION notify_order_status() "
+        "RETURNS TRIGGER AS $$ "
+        "BEGIN "
+        "   PERFORM pg_notify('order_status', NEW.id); "
+        "   RETURN NEW; "
+        "END; "
+        "$$ language 'plpgsql'"
+    );
+    execute("DROP TRIGGER IF EXISTS orders_status_notify ON orders");
+    execute(
+        "CREATE TRIGGER orders_status_notify "
+        "AFTER UPDATE OF status ON orders "
+        "FOR EACH ROW WHEN (OLD.status IS DISTINCT FROM NEW.status) "
+        "EXECUTE FUNCTION notify_order_status()"
+    );
+
+    partitioning::install_functions(*this);
+
+    partitioning::create_partitioned_table(*this, "outbox_events",
+        "   id VARCHAR(255) NOT NULL,"
         "   type VARCHAR(100) NOT NULL,"
-        "   payload JSONB NOT NULL,"
+        "   payload BYTEA NOT NULL,"
         "   status VARCHAR(50) NOT NULL,"
-        "   created_at TIMESTAMP NOT NULL"
-        ")"
-    );
+        "   created_at TIMESTAMP NOT NULL,"
+        "   aggregate_id VARCHAR(255),"
+        "   claimed_until TIMESTAMP,"
+        "   claim_token VARCHAR(64),"
+        "   content_type VARCHAR(100) NOT NULL DEFAULT 'application/json',"
+        "   PRIMARY KEY (id, created_at)",
+        "created_at", 3);
+
+    execute("ALTER TABLE outbox_events ADD COLUMN IF NOT EXISTS aggregate_id VARCHAR(255)");
+    execute("ALTER TABLE outbox_events ADD COLUMN IF NOT EXISTS claimed_until TIMESTAMP");
+    execute("ALTER TABLE outbox_events ADD COLUMN IF NOT EXISTS claim_token VARCHAR(64)");
+    migrate_payload_to_bytea(*this, "outbox_events");
+
+    execute("CREATE INDEX IF NOT EXISTS idx_outbox_status ON outbox_events(status)");
+    execute("CREATE INDEX IF NOT EXISTS idx_outbox_pending_aggregate "
+            "ON outbox_events(aggregate_id, created_at) WHERE status = 'PENDING'");
 }
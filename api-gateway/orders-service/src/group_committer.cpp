@@ -0,0 +1,92 @@
+#include "group_committer.hpp"
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+
+GroupCommitter::GroupCommitter(GroupCommitConfig config, CommitBatch commit_batch)
+    : config_(config), commit_batch_(std::move(commit_batch)) {
+    if (config_.max_batch == 0) config_.max_batch = 1;
+    worker_ = std::thread([this]() { run(); });
+}
+
+GroupCommitter::~GroupCommitter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    worker_.join();
+}
+
+void GroupCommitter::submit(const models::Order& order) {
+    std::future<void> committed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) {
+            throw std::runtime_error("Group committer is shutting down");
+        }
+        pending_.push_back(Pending{order, std::promise<void>{}});
+        committed = pending_.back().committed.get_future();
+    }
+    cv_.notify_all();
+    committed.get();
+}
+
+void GroupCommitter::run() {
+    std::vector<Pending> batch;
+    batch.reserve(config_.max_batch);
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this]() { return stopping_ || !pending_.empty(); });
+            if (pending_.empty()) return;
+
+            // The window starts with the first waiting order; a full batch goes out right away.
+            cv_.wait_for(lock, config_.window, [this]() {
+                return stopping_ || pending_.size() >= config_.max_batch;
+            });
+
+            while (!pending_.empty() && batch.size() < config_.max_batch) {
+                batch.push_back(std::move(pending_.front()));
+                pending_.pop_front();
+            }
+        }
+
+        commit(batch);
+        batch.clear();
+    }
+}
+
+void GroupCommitter::commit(std::vector<Pending>& batch) {
+    std::vector<models::Order> orders;
+    orders.reserve(batch.size());
+    for (const auto& pending : batch) {
+        orders.push_back(pending.order);
+    }
+
+    try {
+        commit_batch_(orders);
+        for (auto& pending : batch) {
+            pending.committed.set_value();
+        }
+        return;
+    } catch (const std::exception& e) {
+        if (batch.size() == 1) {
+            batch.front().committed.set_exception(std::current_exception());
+            return;
+        }
+        std::cerr << "Group commit of " << batch.size() << " orders failed, retrying one by one: "
+                  << e.what() << std::endl;
+    }
+
+    // One bad order must not fail the others that happened to share its transaction.
+    for (auto& pending : batch) {
+        try {
+            commit_batch_({pending.order});
+            pending.committed.set_value();
+        } catch (...) {
+            pending.committed.set_exception(std::current_exception());
+        }
+    }
+}
@@ -1,12 +1,23 @@
+#include <algorithm>
 #include <iostream>
 #include <thread>
 #include <memory>
 #include <cstdlib>
+#include <chrono>
+#include <stdexcept>
+#include <vector>
 #include <httplib.h>
 #include <nlohmann/json.hpp>
 #include "database.hpp"
 #include "order_service.hpp"
 #include "outbox_processor.hpp"
+#include "order_status_projector.hpp"
+#include "order_waiters.hpp"
+#include "partitioning.hpp"
+#include "event_codec.hpp"
+#include "http_rate_limit.hpp"
+#include "etag.hpp"
+#include "compression.hpp"
 
 using json = nlohmann::json;
 using namespace httplib;
@@ -16,18 +27,73 @@ static const char* env_or(const char* key, const char* def_val) {
     return v ? v : def_val;
 }
 
+// Sends body as JSON, compressed when it is at least compress_min_bytes and the client accepts it.
+static void set_json(const Request& req, Response& res, const std::string& body, std::size_t compress_min_bytes) {
+    if (!res.has_header("Vary")) res.set_header("Vary", "Accept-Encoding");
+    if (body.size() >= compress_min_bytes) {
+        auto encoding = compression::negotiate(req.get_header_value("Accept-Encoding"));
+        if (!encoding.empty()) {
+            res.set_header("Content-Encoding", encoding);
+            res.set_content(compression::compress(body, encoding), "application/json");
+            return;
+        }
+    }
+    res.set_content(body, "application/json");
+}
+
+// Tags the response; answers 304 and returns true when the client already holds this version.
+// The tag is weak: it names the data, and the same data goes out gzipped or not depending on
+// Accept-Encoding, which a strong tag would have to tell apart byte for byte.
+static bool not_modified(const Request& req, Response& res, const std::string& tag) {
+    res.set_header("ETag", "W/" + tag);
+    res.set_header("Cache-Control", "no-cache");
+    res.set_header("Vary", "Accept-Encoding");
+    if (!etag::matches(req.get_header_value("If-None-Match"), tag)) return false;
+    res.status = 304;
+    return true;
+}
+
+static RateLimit rate_limit_env(const std::string& prefix, const char* rate, const char* burst) {
+    return RateLimit{std::stod(env_or((prefix + "_RPS").c_str(), rate)),
+                     std::stod(env_or((prefix + "_BURST").c_str(), burst))};
+}
+
 int main() {
     try {
-        auto db = std::make_shared<Database>(
-            env_or("DB_HOST", "localhost"),
-            env_or("DB_PORT", "5432"),
-            env_or("DB_NAME", "orders_db"),
-            env_or("DB_USER", "microservice"),
-            env_or("DB_PASSWORD", "password")
-        );
+        // Every background thread gets its own connection; pqxx connections are not thread-safe.
+        auto connect_db = []() {
+            return std::make_shared<Database>(
+                env_or("DB_HOST", "localhost"),
+                env_or("DB_PORT", "5432"),
+                env_or("DB_NAME", "orders_db"),
+                env_or("DB_USER", "microservice"),
+                env_or("DB_PASSWORD", "password")
+            );
+        };
 
+        auto db = connect_db();
         db->initialize_schema();
 
+        // Optional: read-only endpoints use the replica while its lag stays under the limit.
+        auto replica_host = std::string(env_or("DB_REPLICA_HOST", ""));
+        if (!replica_host.empty()) {
+            db->attach_replica(
+                replica_host,
+                env_or("DB_REPLICA_PORT", env_or("DB_PORT", "5432")),
+                env_or("DB_REPLICA_NAME", env_or("DB_NAME", "orders_db")),
+                env_or("DB_REPLICA_USER", env_or("DB_USER", "microservice")),
+                env_or("DB_REPLICA_PASSWORD", env_or("DB_PASSWORD", "password")),
+                std::chrono::milliseconds(std::stoi(env_or("DB_REPLICA_MAX_LAG_MS", "1000"))),
+                std::chrono::milliseconds(std::stoi(env_or("DB_REPLICA_LAG_CHECK_MS", "1000"))));
+        }
+
+        PartitionMaintainer partition_maintainer(connect_db(),
+            {{"outbox_events", "status = 'PENDING'"}},
+            std::stoi(env_or("PARTITION_RETENTION_DAYS", "7")),
+            std::stoi(env_or("PARTITION_DAYS_AHEAD", "3")),
+            std::chrono::seconds(std::stoi(env_or("PARTITION_MAINTENANCE_INTERVAL", "3600"))));
+        partition_maintainer.run_once();
+
         auto mq_config = MessageQueueConfig{
             env_or("RABBITMQ_HOST", "localhost"),
             env_or("RABBITMQ_PORT", "5672"),
@@ -35,19 +101,87 @@ int main() {
             env_or("RABBITMQ_PASS", "password")
         };
 
-        OrderService order_service(db, mq_config);
-        OutboxProcessor outbox_processor(db, mq_config);
+        // Consumers decode by content type, so this only chooses what this service produces.
+        auto event_encoding = event_codec::parse_encoding(env_or("EVENT_ENCODING", "json"));
+
+        // HTTP handlers run on HTTP_THREADS workers; each OrderService call leases one of these.
+        auto request_db = std::make_shared<DatabasePool>([&connect_db, db]() {
+            auto pooled = connect_db();
+            pooled->share_replica(*db);
+            return pooled;
+        }, std::stoul(env_or("DB_POOL_SIZE", "16")));
+
+        OrderService order_service(request_db, mq_config, event_encoding);
+        if (std::string(env_or("ORDER_GROUP_COMMIT", "0")) == "1") {
+            GroupCommitConfig group_commit_config;
+            group_commit_config.max_batch = std::stoul(env_or("ORDER_GROUP_COMMIT_MAX_BATCH", "64"));
+            group_commit_config.window = std::chrono::microseconds(
+                std::stoi(env_or("ORDER_GROUP_COMMIT_WINDOW_US", "1000")));
+            order_service.enable_group_commit(connect_db(), group_commit_config);
+        }
+        auto max_batch_orders = std::stoul(env_or("ORDERS_BATCH_MAX_SIZE", "1000"));
+        auto compress_min_bytes = std::stoul(env_or("HTTP_COMPRESS_MIN_BYTES", "1024"));
+        OutboxProcessorConfig outbox_config;
+        outbox_config.workers = std::stoul(env_or("OUTBOX_WORKERS", "4"));
+        outbox_config.batch_size = std::stoul(env_or("OUTBOX_BATCH_SIZE", "10"));
+        outbox_config.lease = std::chrono::seconds(std::stoi(env_or("OUTBOX_LEASE_SECONDS", "30")));
+        outbox_config.envelope_max_events = std::stoul(env_or("OUTBOX_ENVELOPE_MAX_EVENTS", "1"));
+        outbox_config.envelope_max_bytes = std::stoul(env_or("OUTBOX_ENVELOPE_MAX_BYTES", "65536"));
+        OutboxProcessor outbox_processor(connect_db, mq_config, outbox_config);
+
+        OrderStatusProjectorConfig projector_config;
+        projector_config.exchange = env_or("PAYMENT_RESULTS_EXCHANGE", "payment.results");
+        projector_config.batch_size = std::stoul(env_or("ORDER_STATUS_BATCH_SIZE", "100"));
+        projector_config.batch_wait = std::chrono::milliseconds(std::stoi(env_or("ORDER_STATUS_BATCH_WAIT_MS", "50")));
+        OrderStatusProjector status_projector(connect_db(), mq_config, projector_config);
 
         std::thread outbox_thread([&outbox_processor]() {
             outbox_processor.run();
         });
 
+        std::thread partition_thread([&partition_maintainer]() {
+            partition_maintainer.run();
+        });
+
+        // Long polls park here until the order's status changes, locally or via NOTIFY.
+        OrderWaiters order_waiters(std::stoul(env_or("ORDER_WAIT_MAX_WAITERS", "48")));
+        order_service.on_status_change([&order_waiters](const std::string& order_id) {
+            order_waiters.notify(order_id);
+        });
+        OrderStatusListener status_listener(connect_db, order_waiters);
+        auto max_wait = std::chrono::seconds(std::stoi(env_or("ORDER_WAIT_MAX_TIMEOUT", "60")));
+
+        std::thread listener_thread([&status_listener]() {
+            status_listener.run();
+        });
+
+        std::thread projector_thread([&status_projector]() {
+            try {
+                status_projector.run();
+            } catch (const std::exception& e) {
+                std::cerr << "Order status projector stopped: " << e.what() << std::endl;
+            }
+        });
+
+        // Per-user budgets; RATE_LIMIT_<ROUTE>_RPS=0 turns a route's limit off.
+        RateLimiter rate_limiter;
+        rate_limiter.set_limit("create_order", rate_limit_env("RATE_LIMIT_CREATE_ORDER", "10", "20"));
+        rate_limiter.set_limit("create_batch", rate_limit_env("RATE_LIMIT_CREATE_BATCH", "1", "5"));
+        rate_limiter.set_limit("read_orders", rate_limit_env("RATE_LIMIT_READ_ORDERS", "50", "100"));
+
         Server svr;
+        // Parked long polls hold a worker each, so the pool must be larger than ORDER_WAIT_MAX_WAITERS.
+        auto http_threads = std::stoul(env_or("HTTP_THREADS", "64"));
+        svr.new_task_queue = [http_threads]() { return new ThreadPool(http_threads); };
+
+        svr.Post("/api/orders", [&order_service, &rate_limiter](const Request& req, Response& res) {
+            // Charged to the user the order is for.
+            if (!rate_limit::admit_body_user(rate_limiter, "create_order", req, res)) return;
 
-        svr.Post("/api/orders", [&order_service](const Request& req, Response& res) {
             try {
                 auto json_body = json::parse(req.body);
                 auto user_id = json_body.at("user_id").get<std::string>();
+                if (!rate_limit::admit_parsed_user(rate_limiter, "create_order", req, user_id, res)) return;
                 auto amount = json_body.at("amount").get<double>();
                 auto description = json_body.value("description", std::string{});
 
@@ -61,9 +195,52 @@ int main() {
             }
         });
 
-        svr.Get("/api/orders", [&order_service](const Request& req, Response& res) {
+        // Body: {"orders": [{"user_id", "amount", "description"?}, ...]}; all or nothing.
+        // A batch may carry many users, so its budget is per client.
+        svr.Post("/api/orders/batch", [&order_service, &rate_limiter, max_batch_orders](const Request& req, Response& res) {
+            if (!rate_limit::admit(rate_limiter, "create_batch", rate_limit::client_key(req), res)) return;
+
+            try {
+                auto json_body = json::parse(req.body);
+                const auto& items = json_body.at("orders");
+                if (!items.is_array() || items.empty()) {
+                    throw std::invalid_argument("orders must be a non-empty array");
+                }
+                if (items.size() > max_batch_orders) {
+                    throw std::invalid_argument("at most " + std::to_string(max_batch_orders) + " orders per batch");
+                }
+
+                std::vector<OrderRequest> requests;
+                requests.reserve(items.size());
+                for (const auto& item : items) {
+                    OrderRequest request;
+                    request.user_id = item.at("user_id").get<std::string>();
+                    request.amount = item.at("amount").get<double>();
+                    request.description = item.value("description", std::string{});
+                    requests.push_back(std::move(request));
+                }
+
+                auto orders = order_service.create_orders(requests);
+                json orders_json = json::array();
+                for (const auto& order : orders) {
+                    orders_json.push_back(order.to_json());
+                }
+
+                res.set_content(json{{"orders", orders_json}}.dump(), "application/json");
+                res.status = 201;
+            } catch (const std::exception& e) {
+                json error = {{"error", e.what()}};
+                res.set_content(error.dump(), "application/json");
+                res.status = 400;
+            }
+        });
+
+        // Polling clients send If-None-Match; an unchanged list costs the query and a hash, not serialization.
+        svr.Get("/api/orders", [&order_service, &rate_limiter, compress_min_bytes](const Request& req, Response& res) {
+            auto user_id = req.get_param_value("user_id");
+            if (!rate_limit::admit(rate_limiter, "read_orders", rate_limit::user_key(req, user_id), res)) return;
+
             try {
-                auto user_id = req.get_param_value("user_id");
                 if (user_id.empty()) {
                     res.status = 400;
                     res.set_content("{\"error\":\"user_id is required\"}", "application/json");
@@ -71,12 +248,18 @@ int main() {
                 }
 
                 auto orders = order_service.get_user_orders(user_id);
+                etag::Builder tag;
+                for (const auto& order : orders) {
+                    tag.add(order.id).add(order.status).add(order.version);
+                }
+                if (not_modified(req, res, tag.str())) return;
+
                 json orders_json = json::array();
                 for (const auto& order : orders) {
                     orders_json.push_back(order.to_json());
                 }
 
-                res.set_content(orders_json.dump(), "application/json");
+                set_json(req, res, orders_json.dump(), compress_min_bytes);
             } catch (const std::exception& e) {
                 json error = {{"error", e.what()}};
                 res.set_content(error.dump(), "application/json");
@@ -84,7 +267,9 @@ int main() {
             }
         });
 
-        svr.Get(R"(/api/orders/([A-Za-z0-9\-]+))", [&order_service](const Request& req, Response& res) {
+        svr.Get(R"(/api/orders/([A-Za-z0-9\-]+))", [&order_service, &rate_limiter, compress_min_bytes](const Request& req, Response& res) {
+            if (!rate_limit::admit(rate_limiter, "read_orders", rate_limit::client_key(req), res)) return;
+
             try {
                 auto order_id = req.matches[1].str();
                 auto order = order_service.get_order(order_id);
@@ -95,7 +280,11 @@ int main() {
                     return;
                 }
 
-                res.set_content(order.to_json().dump(), "application/json");
+                if (not_modified(req, res, etag::Builder().add(order.id).add(order.status).add(order.version).str())) {
+                    return;
+                }
+
+                set_json(req, res, order.to_json().dump(), compress_min_bytes);
             } catch (const std::exception& e) {
                 json error = {{"error", e.what()}};
                 res.set_content(error.dump(), "application/json");
@@ -103,15 +292,64 @@ int main() {
             }
         });
 
+        // GET /api/orders/{id}/wait?timeout=30&since_status=NEW answers as soon as the status
+        // differs from since_status (default: the status at arrival), or with the unchanged order
+        // after timeout seconds. When every waiter slot is taken it answers at once.
+        svr.Get(R"(/api/orders/([A-Za-z0-9\-]+)/wait)",
+                [&order_service, &order_waiters, &rate_limiter, max_wait](const Request& req, Response& res) {
+            if (!rate_limit::admit(rate_limiter, "read_orders", rate_limit::client_key(req), res)) return;
+
+            try {
+                auto order_id = req.matches[1].str();
+                auto timeout = max_wait;
+                if (req.has_param("timeout")) {
+                    timeout = std::min(max_wait, std::chrono::seconds(std::max(0, std::stoi(req.get_param_value("timeout")))));
+                }
+
+                auto ticket = order_waiters.watch(order_id);
+                auto order = order_service.get_order(order_id, true);
+                if (order.id.empty()) {
+                    res.status = 404;
+                    res.set_content("{\"error\":\"Order not found\"}", "application/json");
+                    return;
+                }
+
+                auto since_status = req.has_param("since_status") ? req.get_param_value("since_status") : order.status;
+                auto deadline = std::chrono::steady_clock::now() + timeout;
+                while (ticket && order.status == since_status) {
+                    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        deadline - std::chrono::steady_clock::now());
+                    if (remaining.count() <= 0 || !order_waiters.wait(*ticket, remaining)) break;
+                    order = order_service.get_order(order_id, true);
+                }
+
+                res.set_content(order.to_json().dump(), "application/json");
+            } catch (const std::exception& e) {
+                json error = {{"error", e.what()}};
+                res.set_content(error.dump(), "application/json");
+                res.status = 400;
+            }
+        });
+
         svr.Get("/health", [](const Request&, Response& res) {
             res.set_content("OK", "text/plain");
         });
 
+        svr.Get("/metrics/rate-limits", [&rate_limiter](const Request&, Response& res) {
+            res.set_content(rate_limiter.stats().dump(), "application/json");
+        });
+
         std::cout << "Orders Service starting on port 8080..." << std::endl;
         svr.listen("0.0.0.0", 8080);
 
         outbox_processor.stop();
+        status_projector.stop();
+        status_listener.stop();
+        partition_maintainer.stop();
         outbox_thread.join();
+        projector_thread.join();
+        listener_thread.join();
+        partition_thread.join();
 
     } catch (const std::exception& e) {
         std::cerr << "Fatal error: " << e.what() << std::endl;
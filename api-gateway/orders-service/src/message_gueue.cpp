@@ -2,6 +2,9 @@
 #include <amqp_tcp_socket.h>
 #include <stdexcept>
 #include <string>
+#include <sys/time.h>
+#include <iostream>
+#include "event_batch.hpp"
 
 static void ensure_ok(const amqp_rpc_reply_t& reply, const char* what) {
     if (reply.reply_type != AMQP_RESPONSE_NORMAL) {
@@ -9,6 +12,31 @@ static void ensure_ok(const amqp_rpc_reply_t& reply, const char* what) {
     }
 }
 
+static std::string content_type_of(const amqp_envelope_t& envelope) {
+    const auto& props = envelope.message.properties;
+    if (!(props._flags & AMQP_BASIC_CONTENT_TYPE_FLAG)) return {};
+    return std::string(static_cast<char*>(props.content_type.bytes), props.content_type.len);
+}
+
+static bool is_event_batch(const amqp_envelope_t& envelope) {
+    const auto& props = envelope.message.properties;
+    if (!(props._flags & AMQP_BASIC_TYPE_FLAG)) return false;
+    return std::string(static_cast<char*>(props.type.bytes), props.type.len) == event_batch::message_type();
+}
+
+// One entry per event carried by the delivery; a malformed envelope yields none.
+static std::vector<std::string> events_of(const amqp_envelope_t& envelope) {
+    std::string body(static_cast<char*>(envelope.message.body.bytes), envelope.message.body.len);
+    if (!is_event_batch(envelope)) return {std::move(body)};
+
+    try {
+        return event_batch::unpack(body);
+    } catch (const std::exception& e) {
+        std::cerr << "Dropping malformed event batch: " << e.what() << std::endl;
+        return {};
+    }
+}
+
 MessageQueue::MessageQueue(const MessageQueueConfig& config) {
     connection_ = amqp_new_connection();
     if (!connection_) {
@@ -33,11 +61,16 @@ MessageQueue::MessageQueue(const MessageQueueConfig& config) {
                             AMQP_SASL_METHOD_PLAIN,
                             config.user.c_str(),
                             config.password.c_str());
-    ensure_ok(reply, "login");
-
-    amqp_channel_open(connection_, channel_);
-    reply = amqp_get_rpc_reply(connection_);
-    ensure_ok(reply, "channel_open");
+    if (reply.reply_type == AMQP_RESPONSE_NORMAL) {
+        amqp_channel_open(connection_, channel_);
+        reply = amqp_get_rpc_reply(connection_);
+    }
+    if (reply.reply_type != AMQP_RESPONSE_NORMAL) {
+        // The destructor does not run for a throwing constructor.
+        amqp_destroy_connection(connection_);
+        connection_ = nullptr;
+        throw std::runtime_error("RabbitMQ error: login or channel_open");
+    }
 }
 
 MessageQueue::~MessageQueue() {
@@ -49,7 +82,8 @@ MessageQueue::~MessageQueue() {
     }
 }
 
-void MessageQueue::publish(const std::string& queue, const std::string& message) {
+void MessageQueue::publish(const std::string& queue, const std::string& message,
+                           const std::string& content_type, bool batch) {
     amqp_bytes_t queue_bytes = amqp_cstring_bytes(queue.c_str());
 
     amqp_queue_declare(connection_, channel_, queue_bytes, 0, 1, 0, 0, amqp_empty_table);
@@ -63,7 +97,11 @@ void MessageQueue::publish(const std::string& queue, const std::string& message)
     amqp_basic_properties_t props;
     props._flags = AMQP_BASIC_DELIVERY_MODE_FLAG | AMQP_BASIC_CONTENT_TYPE_FLAG;
     props.delivery_mode = 2;
-    props.content_type = amqp_cstring_bytes("application/json");
+    props.content_type = amqp_cstring_bytes(content_type.c_str());
+    if (batch) {
+        props._flags |= AMQP_BASIC_TYPE_FLAG;
+        props.type = amqp_cstring_bytes(event_batch::message_type());
+    }
 
     int result = amqp_basic_publish(connection_, channel_, amqp_cstring_bytes(""),
                                     queue_bytes, 0, 0, &props, message_bytes);
@@ -98,3 +136,68 @@ void MessageQueue::consume(const std::string& queue,
         }
     }
 }
+
+void MessageQueue::start_consuming_exchange(const std::string& exchange, const std::string& queue,
+                                            const std::string& binding_key, std::uint16_t prefetch) {
+    amqp_bytes_t exchange_bytes = amqp_cstring_bytes(exchange.c_str());
+    amqp_bytes_t queue_bytes = amqp_cstring_bytes(queue.c_str());
+
+    amqp_exchange_declare(connection_, channel_, exchange_bytes, amqp_cstring_bytes("topic"),
+                          0, 1, 0, 0, amqp_empty_table);
+    auto reply = amqp_get_rpc_reply(connection_);
+    ensure_ok(reply, "exchange_declare");
+
+    amqp_queue_declare(connection_, channel_, queue_bytes, 0, 1, 0, 0, amqp_empty_table);
+    reply = amqp_get_rpc_reply(connection_);
+    ensure_ok(reply, "queue_declare");
+
+    amqp_queue_bind(connection_, channel_, queue_bytes, exchange_bytes,
+                    amqp_cstring_bytes(binding_key.c_str()), amqp_empty_table);
+    reply = amqp_get_rpc_reply(connection_);
+    ensure_ok(reply, "queue_bind");
+
+    amqp_basic_qos(connection_, channel_, 0, prefetch, 0);
+    reply = amqp_get_rpc_reply(connection_);
+    ensure_ok(reply, "basic_qos");
+
+    amqp_basic_consume(connection_, channel_, queue_bytes, amqp_empty_bytes, 0, 0, 0, amqp_empty_table);
+    reply = amqp_get_rpc_reply(connection_);
+    ensure_ok(reply, "basic_consume");
+}
+
+bool MessageQueue::next_delivery(Delivery& delivery, std::chrono::milliseconds timeout) {
+    amqp_envelope_t envelope;
+    amqp_maybe_release_buffers(connection_);
+
+    timeval tv;
+    tv.tv_sec = static_cast<long>(timeout.count() / 1000);
+    tv.tv_usec = static_cast<long>((timeout.count() % 1000) * 1000);
+
+    amqp_rpc_reply_t ret = amqp_consume_message(connection_, &envelope, &tv, 0);
+    if (ret.reply_type == AMQP_RESPONSE_NORMAL) {
+        delivery.events = events_of(envelope);
+        delivery.content_type = content_type_of(envelope);
+        delivery.delivery_tag = envelope.delivery_tag;
+        delivery.redelivered = envelope.redelivered != 0;
+        amqp_destroy_envelope(&envelope);
+        return true;
+    }
+
+    if (ret.reply_type == AMQP_RESPONSE_LIBRARY_EXCEPTION && ret.library_error == AMQP_STATUS_TIMEOUT) {
+        return false;
+    }
+
+    throw std::runtime_error("RabbitMQ consume error");
+}
+
+void MessageQueue::ack_up_to(std::uint64_t delivery_tag) {
+    if (amqp_basic_ack(connection_, channel_, delivery_tag, 1) != AMQP_STATUS_OK) {
+        throw std::runtime_error("Failed to ack messages");
+    }
+}
+
+void MessageQueue::nack_up_to(std::uint64_t delivery_tag, bool requeue) {
+    if (amqp_basic_nack(connection_, channel_, delivery_tag, 1, requeue ? 1 : 0) != AMQP_STATUS_OK) {
+        throw std::runtime_error("Failed to nack messages");
+    }
+}
@@ -1,34 +1,49 @@
 #include "order_service.hpp"
 #include "utils.hpp"
 #include <chrono>
-#include <ctime>
+#include <tuple>
 
-OrderService::OrderService(std::shared_ptr<Database> db,
-                           const MessageQueueConfig& mq_config)
-    : db_(std::move(db)), mq_config_(mq_config) {
+OrderService::OrderService(std::shared_ptr<DatabasePool> db,
+                           const MessageQueueConfig& mq_config,
+                           event_codec::Encoding event_encoding)
+    : db_(std::move(db)), mq_config_(mq_config), event_encoding_(event_encoding) {
+}
+
+void OrderService::enable_group_commit(std::shared_ptr<Database> commit_db, GroupCommitConfig config) {
+    commit_db_ = std::move(commit_db);
+    group_committer_ = std::make_unique<GroupCommitter>(config,
+        [this](const std::vector<models::Order>& orders) {
+            auto& tx = commit_db_->begin_transaction();
+            write_orders(tx, orders);
+            tx.commit();
+        });
 }
 
 models::Order OrderService::create_order(const std::string& user_id,
                                         double amount,
                                         const std::string& description) {
-    auto& tx = db_->begin_transaction();
-
-    auto order_id = utils::generate_uuid();
-
     models::Order order;
-    order.id = order_id;
+    order.id = utils::generate_uuid();
     order.user_id = user_id;
     order.amount = amount;
     order.description = description;
     order.status = "NEW";
     order.created_at = std::chrono::system_clock::now();
 
-    db_->execute(tx,
+    if (group_committer_) {
+        group_committer_->submit(order);
+        return order;
+    }
+
+    auto db = db_->acquire();
+    auto& tx = db->begin_transaction();
+
+    db->execute(tx,
         "INSERT INTO orders (id, user_id, amount, description, status, created_at) "
-        "VALUES ($1, $2, $3, $4, $5, to_timestamp($6))",
+        "VALUES ($1, $2, $3, $4, $5, to_timestamp($6 / 1000.0) AT TIME ZONE 'UTC')",
         order.id, order.user_id, order.amount,
         order.description, order.status,
-        static_cast<long long>(std::chrono::system_clock::to_time_t(order.created_at)));
+        static_cast<long long>(utils::epoch_ms(order.created_at)));
 
     models::messages::PaymentRequest payment_request;
     payment_request.order_id = order.id;
@@ -37,21 +52,80 @@ models::Order OrderService::create_order(const std::string& user_id,
 
     auto outbox_id = utils::generate_uuid();
 
-    db_->execute(tx,
-        "INSERT INTO outbox_events (id, type, payload, status, created_at) "
-        "VALUES ($1, 'PAYMENT_REQUEST', $2::jsonb, 'PENDING', to_timestamp($3))",
-        outbox_id, payment_request.to_json().dump(),
-        static_cast<long long>(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now())));
+    db->execute(tx,
+        "INSERT INTO outbox_events (id, type, payload, content_type, status, created_at, aggregate_id) "
+        "VALUES ($1, 'PAYMENT_REQUEST', $2, $3, 'PENDING', to_timestamp($4 / 1000.0) AT TIME ZONE 'UTC', $5)",
+        outbox_id,
+        pqxx::binarystring(event_codec::encode(payment_request.to_json(), event_encoding_)),
+        std::string(event_codec::content_type(event_encoding_)),
+        static_cast<long long>(utils::epoch_ms(std::chrono::system_clock::now())),
+        order.id);
 
     tx.commit();
 
     return order;
 }
 
+std::vector<models::Order> OrderService::create_orders(const std::vector<OrderRequest>& requests) {
+    std::vector<models::Order> orders;
+    orders.reserve(requests.size());
+
+    auto now = std::chrono::system_clock::now();
+    for (const auto& request : requests) {
+        models::Order order;
+        order.id = utils::generate_uuid();
+        order.user_id = request.user_id;
+        order.amount = request.amount;
+        order.description = request.description;
+        order.status = "NEW";
+        order.created_at = now;
+        orders.push_back(std::move(order));
+    }
+
+    auto db = db_->acquire();
+    auto& tx = db->begin_transaction();
+    write_orders(tx, orders);
+    tx.commit();
+
+    return orders;
+}
+
+// COPY skips to_timestamp(), so created_at is written as RFC 3339 text, in UTC like the other writes.
+void OrderService::write_orders(pqxx::transaction_base& tx, const std::vector<models::Order>& orders) {
+    std::string content_type = event_codec::content_type(event_encoding_);
+
+    {
+        pqxx::stream_to stream(tx, "orders",
+            std::vector<std::string>{"id", "user_id", "amount", "description", "status", "created_at"});
+        for (const auto& order : orders) {
+            stream << std::make_tuple(order.id, order.user_id, order.amount,
+                                      order.description, order.status, utils::time_to_string(order.created_at));
+        }
+        stream.complete();
+    }
+
+    {
+        pqxx::stream_to stream(tx, "outbox_events",
+            std::vector<std::string>{"id", "type", "payload", "content_type", "status", "created_at", "aggregate_id"});
+        for (const auto& order : orders) {
+            models::messages::PaymentRequest payment_request;
+            payment_request.order_id = order.id;
+            payment_request.user_id = order.user_id;
+            payment_request.amount = order.amount;
+
+            stream << std::make_tuple(utils::generate_uuid(), std::string("PAYMENT_REQUEST"),
+                                      Database::bytea_hex(event_codec::encode(payment_request.to_json(), event_encoding_)),
+                                      content_type, std::string("PENDING"),
+                                      utils::time_to_string(order.created_at), order.id);
+        }
+        stream.complete();
+    }
+}
+
 std::vector<models::Order> OrderService::get_user_orders(const std::string& user_id) {
-    auto result = db_->query(
-        "SELECT id, user_id, amount, description, status, "
-        "extract(epoch from created_at) as created_at "
+    auto result = db_->acquire()->query_read(
+        "SELECT id, user_id, amount, description, status, version, "
+        "(extract(epoch from created_at) * 1000)::bigint as created_at_ms "
         "FROM orders WHERE user_id = $1 ORDER BY created_at DESC",
         user_id);
 
@@ -63,9 +137,9 @@ std::vector<models::Order> OrderService::get_user_orders(const std::string& user
         order.amount = row["amount"].as<double>();
         order.description = row["description"].is_null() ? std::string{} : row["description"].as<std::string>();
         order.status = row["status"].as<std::string>();
+        order.version = row["version"].as<int>();
 
-        auto created_sec = static_cast<std::time_t>(row["created_at"].as<double>());
-        order.created_at = std::chrono::system_clock::from_time_t(created_sec);
+        order.created_at = utils::from_epoch_ms(row["created_at_ms"].as<long long>());
 
         orders.push_back(std::move(order));
     }
@@ -73,12 +147,13 @@ std::vector<models::Order> OrderService::get_user_orders(const std::string& user
     return orders;
 }
 
-models::Order OrderService::get_order(const std::string& order_id) {
-    auto result = db_->query(
-        "SELECT id, user_id, amount, description, status, "
-        "extract(epoch from created_at) as created_at "
-        "FROM orders WHERE id = $1",
-        order_id);
+models::Order OrderService::get_order(const std::string& order_id, bool from_primary) {
+    static const std::string sql =
+        "SELECT id, user_id, amount, description, status, version, "
+        "(extract(epoch from created_at) * 1000)::bigint as created_at_ms "
+        "FROM orders WHERE id = $1";
+    auto db = db_->acquire();
+    auto result = from_primary ? db->query(sql, order_id) : db->query_read(sql, order_id);
 
     if (result.empty()) {
         return models::Order{};
@@ -91,16 +166,24 @@ models::Order OrderService::get_order(const std::string& order_id) {
     order.amount = row["amount"].as<double>();
     order.description = row["description"].is_null() ? std::string{} : row["description"].as<std::string>();
     order.status = row["status"].as<std::string>();
+    order.version = row["version"].as<int>();
 
-    auto created_sec = static_cast<std::time_t>(row["created_at"].as<double>());
-    order.created_at = std::chrono::system_clock::from_time_t(created_sec);
+    order.created_at = utils::from_epoch_ms(row["created_at_ms"].as<long long>());
 
     return order;
 }
 
 void OrderService::update_order_status(const std::string& order_id,
                                       const std::string& status) {
-    db_->execute(
-        "UPDATE orders SET status = $1 WHERE id = $2",
+    db_->acquire()->execute(
+        "UPDATE orders SET status = $1, version = version + 1 WHERE id = $2",
         status, order_id);
+
+    if (status_listener_) {
+        status_listener_(order_id);
+    }
+}
+
+void OrderService::on_status_change(std::function<void(const std::string&)> listener) {
+    status_listener_ = std::move(listener);
 }
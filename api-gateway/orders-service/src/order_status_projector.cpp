@@ -0,0 +1,139 @@
+#include "order_status_projector.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <thread>
+#include <unordered_map>
+#include <nlohmann/json.hpp>
+#include "models.hpp"
+#include "event_codec.hpp"
+
+using json = nlohmann::json;
+
+OrderStatusProjector::OrderStatusProjector(std::shared_ptr<Database> db,
+                                           const MessageQueueConfig& mq_config,
+                                           OrderStatusProjectorConfig config)
+    : db_(std::move(db)), mq_config_(mq_config), config_(std::move(config)) {
+    // A batch is acked as a whole, so it can hold no more than the prefetch lets through,
+    // and AMQP caps the prefetch count at 65535.
+    config_.batch_size = std::clamp<std::size_t>(config_.batch_size, 1,
+                                                 std::numeric_limits<std::uint16_t>::max());
+}
+
+// A fresh connection and channel; the exchange, queue and binding are declared again in case
+// the broker lost them along with the old connection.
+void OrderStatusProjector::connect() {
+    message_queue_.reset();
+    auto message_queue = std::make_unique<MessageQueue>(mq_config_);
+    message_queue->start_consuming_exchange(config_.exchange, config_.queue, "#",
+                                            static_cast<std::uint16_t>(config_.batch_size));
+    message_queue_ = std::move(message_queue);
+}
+
+void OrderStatusProjector::run() {
+    std::vector<Delivery> batch;
+    batch.reserve(config_.batch_size);
+
+    while (running_.load()) {
+        if (!message_queue_) {
+            try {
+                connect();
+            } catch (const std::exception& e) {
+                std::cerr << "Order status projector cannot connect: " << e.what() << std::endl;
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+                continue;
+            }
+        }
+
+        batch.clear();
+
+        // A broken connection stays broken, so it is rebuilt; the broker requeues whatever
+        // was delivered on it and not acked.
+        try {
+            collect_batch(batch);
+        } catch (const std::exception& e) {
+            std::cerr << "Order status projector consume failed, reconnecting: " << e.what() << std::endl;
+            message_queue_.reset();
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            continue;
+        }
+        if (batch.empty()) continue;
+
+        try {
+            apply_batch(batch);
+        } catch (const std::exception& e) {
+            std::cerr << "Order status projector error: " << e.what() << std::endl;
+            try {
+                message_queue_->nack_up_to(batch.back().delivery_tag, true);
+            } catch (const std::exception& nack_error) {
+                std::cerr << "Order status projector nack failed: " << nack_error.what() << std::endl;
+                message_queue_.reset();
+            }
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            continue;
+        }
+
+        try {
+            message_queue_->ack_up_to(batch.back().delivery_tag);
+        } catch (const std::exception& e) {
+            std::cerr << "Order status projector ack failed, reconnecting: " << e.what() << std::endl;
+            message_queue_.reset();
+        }
+    }
+}
+
+void OrderStatusProjector::stop() {
+    running_.store(false);
+}
+
+void OrderStatusProjector::collect_batch(std::vector<Delivery>& batch) {
+    Delivery delivery;
+
+    // Block briefly for the first message so stop() is noticed, then top up until full or the window closes.
+    if (!message_queue_->next_delivery(delivery, std::chrono::seconds(1))) return;
+    batch.push_back(std::move(delivery));
+
+    auto deadline = std::chrono::steady_clock::now() + config_.batch_wait;
+    while (batch.size() < config_.batch_size) {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now());
+        if (remaining.count() <= 0) break;
+        if (!message_queue_->next_delivery(delivery, remaining)) break;
+        batch.push_back(std::move(delivery));
+    }
+}
+
+void OrderStatusProjector::apply_batch(const std::vector<Delivery>& batch) {
+    std::unordered_map<std::string, std::string> latest;
+    latest.reserve(batch.size());
+
+    for (const auto& delivery : batch) {
+        for (const auto& event : delivery.events) {
+            try {
+                auto result = models::messages::PaymentResult::from_json(
+                    event_codec::decode(event, delivery.content_type));
+                latest[result.order_id] = result.success ? "FINISHED" : "CANCELLED";
+            } catch (const std::exception& e) {
+                std::cerr << "Skipping malformed payment result: " << e.what() << std::endl;
+            }
+        }
+    }
+
+    if (latest.empty()) return;
+
+    std::vector<std::string> ids;
+    std::vector<std::string> statuses;
+    ids.reserve(latest.size());
+    statuses.reserve(latest.size());
+    for (const auto& entry : latest) {
+        ids.push_back(entry.first);
+        statuses.push_back(entry.second);
+    }
+
+    db_->execute(
+        "UPDATE orders AS o SET status = u.status, version = o.version + 1 "
+        "FROM unnest($1::text[], $2::text[]) AS u(id, status) "
+        "WHERE o.id = u.id AND o.status = 'NEW'",
+        Database::array_literal(ids), Database::array_literal(statuses));
+}
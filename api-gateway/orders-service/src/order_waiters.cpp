@@ -0,0 +1,68 @@
+#include "order_waiters.hpp"
+#include <iostream>
+#include <thread>
+
+OrderWaiters::Ticket::~Ticket() {
+    waiters_.release(*this);
+}
+
+std::unique_ptr<OrderWaiters::Ticket> OrderWaiters::watch(const std::string& order_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (waiting_ >= max_waiters_) return nullptr;
+
+    auto& entry = entries_[order_id];
+    if (!entry) entry = std::make_unique<Entry>();
+    ++entry->tickets;
+    ++waiting_;
+    return std::unique_ptr<Ticket>(new Ticket(*this, order_id, entry.get(), entry->generation));
+}
+
+bool OrderWaiters::wait(Ticket& ticket, std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto* entry = ticket.entry_;
+    bool changed = entry->changed.wait_for(lock, timeout, [&]() {
+        return entry->generation != ticket.generation_;
+    });
+    ticket.generation_ = entry->generation;
+    return changed;
+}
+
+void OrderWaiters::notify(const std::string& order_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(order_id);
+    if (it == entries_.end()) return;
+    ++it->second->generation;
+    it->second->changed.notify_all();
+}
+
+void OrderWaiters::release(Ticket& ticket) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --waiting_;
+    if (--ticket.entry_->tickets == 0) {
+        entries_.erase(ticket.order_id_);
+    }
+}
+
+OrderStatusListener::OrderStatusListener(DatabaseFactory connect_db, OrderWaiters& waiters)
+    : connect_db_(std::move(connect_db)), waiters_(waiters) {}
+
+void OrderStatusListener::run() {
+    while (running_.load()) {
+        try {
+            auto db = connect_db_();
+            db->listen("order_status", [this](const std::string& order_id) {
+                waiters_.notify(order_id);
+            });
+            while (running_.load()) {
+                db->wait_for_notifications(std::chrono::seconds(1));
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Order status listener error: " << e.what() << std::endl;
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+    }
+}
+
+void OrderStatusListener::stop() {
+    running_.store(false);
+}
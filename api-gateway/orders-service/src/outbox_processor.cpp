@@ -2,57 +2,126 @@
 #include <thread>
 #include <chrono>
 #include <iostream>
+#include "utils.hpp"
+#include "event_batch.hpp"
 
-OutboxProcessor::OutboxProcessor(std::shared_ptr<Database> db,
-                                 const MessageQueueConfig& mq_config)
-    : db_(std::move(db)), mq_config_(mq_config), running_(true) {
-    message_queue_ = std::make_unique<MessageQueue>(mq_config_);
+OutboxProcessor::OutboxProcessor(const DatabaseFactory& connect_db,
+                                 const MessageQueueConfig& mq_config,
+                                 OutboxProcessorConfig config)
+    : mq_config_(mq_config), config_(config) {
+    if (config_.workers == 0) config_.workers = 1;
+
+    workers_.resize(config_.workers);
+    for (std::size_t i = 0; i < workers_.size(); ++i) {
+        workers_[i].index = i;
+        workers_[i].db = connect_db();
+        workers_[i].message_queue = std::make_unique<MessageQueue>(mq_config_);
+    }
 }
 
 void OutboxProcessor::run() {
+    std::vector<std::thread> threads;
+    threads.reserve(workers_.size());
+    for (auto& worker : workers_) {
+        threads.emplace_back([this, &worker]() { run_worker(worker); });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+void OutboxProcessor::stop() {
+    running_ = false;
+}
+
+void OutboxProcessor::run_worker(Worker& worker) {
     while (running_) {
+        std::size_t claimed = 0;
         try {
-            process_pending_events();
+            claimed = process_pending_events(worker);
         } catch (const std::exception& e) {
             std::cerr << "Outbox processor error: " << e.what() << std::endl;
         }
 
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+        // A full batch means more is probably waiting; otherwise poll at the usual pace.
+        if (claimed < config_.batch_size) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
     }
 }
 
-void OutboxProcessor::stop() {
-    running_ = false;
-}
+std::vector<OutboxProcessor::ClaimedEvent> OutboxProcessor::claim_batch(Worker& worker,
+                                                                       const std::string& claim_token) {
+    auto& tx = worker.db->begin_transaction();
 
-void OutboxProcessor::process_pending_events() {
-    auto& tx = db_->begin_transaction();
+    // Only the oldest pending event of each aggregate is claimable, which keeps per-order
+    // ordering even when several service replicas run the same worker index.
+    auto rows = worker.db->query(tx,
+        "UPDATE outbox_events AS o "
+        "SET claimed_until = now() + $1 * interval '1 second', claim_token = $2 "
+        "FROM ("
+        "   SELECT e.id, e.created_at FROM outbox_events AS e "
+        "   WHERE e.status = 'PENDING' "
+        "     AND (e.claimed_until IS NULL OR e.claimed_until < now()) "
+        "     AND (hashtext(coalesce(e.aggregate_id, e.id)) & 2147483647) % $3 = $4 "
+        "     AND NOT EXISTS ("
+        "         SELECT 1 FROM outbox_events AS p "
+        "         WHERE p.status = 'PENDING' AND p.aggregate_id = e.aggregate_id "
+        "           AND p.created_at < e.created_at) "
+        "   ORDER BY e.created_at ASC "
+        "   LIMIT $5 "
+        "   FOR UPDATE SKIP LOCKED"
+        ") AS c "
+        "WHERE o.id = c.id AND o.created_at = c.created_at "
+        "RETURNING o.id, o.type, o.payload, o.content_type",
+        static_cast<long long>(config_.lease.count()), claim_token,
+        static_cast<long long>(config_.workers), static_cast<long long>(worker.index),
+        static_cast<long long>(config_.batch_size));
 
-    auto events = db_->query(tx,
-        "SELECT id, type, payload FROM outbox_events "
-        "WHERE status = 'PENDING' "
-        "ORDER BY created_at ASC "
-        "FOR UPDATE SKIP LOCKED LIMIT 10");
+    tx.commit();
 
-    for (const auto& row : events) {
-        auto event_id = row["id"].as<std::string>();
-        auto type = row["type"].as<std::string>();
-        auto payload = row["payload"].as<std::string>();
+    std::vector<ClaimedEvent> events;
+    events.reserve(rows.size());
+    for (const auto& row : rows) {
+        events.push_back(ClaimedEvent{row["id"].as<std::string>(),
+                                      row["type"].as<std::string>(),
+                                      pqxx::binarystring(row["payload"]).str(),
+                                      row["content_type"].as<std::string>()});
+    }
+    return events;
+}
 
-        try {
-            if (type == "PAYMENT_REQUEST") {
-                message_queue_->publish("payment.requests", payload);
-            }
+std::size_t OutboxProcessor::process_pending_events(Worker& worker) {
+    auto claim_token = utils::generate_uuid();
+    auto events = claim_batch(worker, claim_token);
+    if (events.empty()) return 0;
 
-            db_->execute(tx,
-                "UPDATE outbox_events SET status = 'PROCESSED' WHERE id = $1",
-                event_id);
+    event_batch::Batcher batcher(config_.envelope_max_events, config_.envelope_max_bytes,
+        [&worker](const std::string& queue, const std::string& body,
+                  const std::string& content_type, bool batch) {
+            worker.message_queue->publish(queue, body, content_type, batch);
+        });
 
-        } catch (const std::exception& e) {
-            std::cerr << "Failed to process outbox event " << event_id
-                      << ": " << e.what() << std::endl;
+    std::vector<std::string> unpublishable;
+
+    // Publishing happens outside any transaction; a failed event keeps its lease and is retried once it expires.
+    for (const auto& event : events) {
+        if (event.type == "PAYMENT_REQUEST") {
+            batcher.add("payment.requests", event.content_type, event.id, event.payload);
+        } else {
+            unpublishable.push_back(event.id);
         }
     }
 
-    tx.commit();
+    auto published = batcher.finish();
+    published.insert(published.end(), unpublishable.begin(), unpublishable.end());
+
+    if (!published.empty()) {
+        worker.db->execute(
+            "UPDATE outbox_events SET status = 'PROCESSED', claimed_until = NULL "
+            "WHERE id = ANY($1::text[]) AND claim_token = $2",
+            Database::array_literal(published), claim_token);
+    }
+
+    return events.size();
 }
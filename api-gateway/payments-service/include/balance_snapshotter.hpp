@@ -0,0 +1,25 @@
+#ifndef BALANCE_SNAPSHOTTER_HPP
+#define BALANCE_SNAPSHOTTER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include "database.hpp"
+
+// Periodically folds new ledger entries into the account balance snapshot, so balance reads
+// only sum the entries written since the last refresh.
+class BalanceSnapshotter {
+public:
+    BalanceSnapshotter(std::shared_ptr<Database> db, std::chrono::seconds interval);
+
+    void run_once();
+    void run();
+    void stop();
+
+private:
+    std::shared_ptr<Database> db_;
+    std::chrono::seconds interval_;
+    std::atomic_bool running_{true};
+};
+
+#endif
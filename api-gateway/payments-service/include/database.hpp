@@ -1,10 +1,16 @@
 #ifndef DATABASE_HPP
 #define DATABASE_HPP
 
+#include <chrono>
+#include <iostream>
 #include <memory>
+#include <stdexcept>
 #include <string>
 #include <utility>
+#include <vector>
 #include <pqxx/pqxx>
+#include "read_replica.hpp"
+#include "query_pipeline.hpp"
 
 class Database {
 public:
@@ -16,6 +22,17 @@ public:
 
     pqxx::transaction_base& begin_transaction();
 
+    // Optional read replica for query_read(). It is used while its replay lag, checked at most
+    // once per lag_check_interval, stays within max_lag; otherwise, or while it is unreachable,
+    // reads fall back to the primary. Call before the Database is shared between threads.
+    void attach_replica(const std::string& host,
+                        const std::string& port,
+                        const std::string& dbname,
+                        const std::string& user,
+                        const std::string& password,
+                        std::chrono::milliseconds max_lag,
+                        std::chrono::milliseconds lag_check_interval);
+
     void commit() {
         if (transaction_) {
             transaction_->commit();
@@ -47,6 +64,16 @@ public:
         return tx.exec_params(sql, std::forward<Args>(args)...);
     }
 
+    // Prepared statements belong to this connection; prepare once, then call by name.
+    void prepare(const std::string& name, const std::string& sql);
+
+    // Runs outside an explicit transaction, so a single statement costs a single round trip.
+    template<typename... Args>
+    pqxx::result query_prepared(const std::string& name, Args&&... args) {
+        pqxx::nontransaction nt(*conn_);
+        return nt.exec_prepared(name, std::forward<Args>(args)...);
+    }
+
     template<typename... Args>
     void execute(const std::string& sql, Args&&... args) {
         pqxx::work w(*conn_);
@@ -59,11 +86,41 @@ public:
         tx.exec_params(sql, std::forward<Args>(args)...);
     }
 
+    // Read-only statement outside a transaction; served by the replica when it is in sync.
+    template<typename... Args>
+    pqxx::result query_read(const std::string& sql, Args&&... args);
+
+    // Batches of statements sent together on the primary; see QueryPipeline. Connects on first use.
+    QueryPipeline& pipeline() { return *pipeline_; }
+
     void initialize_schema();
 
+    // Postgres array literal for binding a list as one text parameter, e.g. $1::text[].
+    static std::string array_literal(const std::vector<std::string>& values);
+
 private:
     std::unique_ptr<pqxx::connection> conn_;
     std::unique_ptr<pqxx::work> transaction_;
+    std::unique_ptr<QueryPipeline> pipeline_;
+
+    // Thread-safe; query_read() may be called from any number of threads at once.
+    std::shared_ptr<ReadReplica> replica_;
 };
 
+template<typename... Args>
+pqxx::result Database::query_read(const std::string& sql, Args&&... args) {
+    if (replica_) {
+        if (auto lease = replica_->acquire()) {
+            try {
+                pqxx::nontransaction nt(*lease);
+                return nt.exec_params(sql, args...);
+            } catch (const pqxx::broken_connection& e) {
+                std::cerr << "Read replica unavailable, using primary: " << e.what() << std::endl;
+                lease.discard();
+            }
+        }
+    }
+    return query(sql, std::forward<Args>(args)...);
+}
+
 #endif
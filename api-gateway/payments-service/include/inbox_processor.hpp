@@ -3,26 +3,57 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 #include <atomic>
+#include <functional>
 #include "database.hpp"
+#include "shard_map.hpp"
 #include "message_queue.hpp"
-#include "payment_service.hpp"
+#include "event_codec.hpp"
+#include "retry_scheduler.hpp"
 
 class InboxProcessor {
 public:
-    InboxProcessor(std::shared_ptr<Database> db,
+    using ShardRouterFactory = std::function<std::shared_ptr<ShardRouter>()>;
+
+    // Each request is applied on the shard that owns the paying user's account. Failed requests
+    // are stored for the retry scheduler, which runs on its own thread and connections.
+    InboxProcessor(const ShardRouterFactory& connect_shards,
                    const MessageQueueConfig& mq_config,
-                   PaymentService& payment_service);
+                   RetryConfig retry_config = {},
+                   event_codec::Encoding event_encoding = event_codec::Encoding::json);
     void run();
     void stop();
 
 private:
-    void handle_payment_request(const std::string& message);
+    // Arguments of one process_payment_request call.
+    struct PaymentCall {
+        std::string event_id;
+        std::string order_id;
+        std::string user_id;
+        double amount{};
+        std::string payload;
+        std::string content_type;
+        std::string outbox_id;
+        std::string success_payload;
+        std::string failure_payload;
+        std::string result_content_type;
+    };
+
+    // A delivery carrying several requests sends them to each shard as one pipeline.
+    void handle_payment_requests(const std::vector<std::string>& messages, const std::string& content_type);
+    void handle_payment_request(const std::string& message, const std::string& content_type);
+    // Throws if the message is not a readable payment request.
+    PaymentCall payment_call(const std::string& message, const std::string& content_type) const;
+    // Throws if the request could not be applied.
+    void apply(ShardRouter& shards, const std::string& message, const std::string& content_type);
+    void store_for_retry(const std::string& message, const std::string& content_type, const std::string& error);
 
-    std::shared_ptr<Database> db_;
+    std::shared_ptr<ShardRouter> shards_;
     MessageQueueConfig mq_config_;
-    PaymentService& payment_service_;
+    event_codec::Encoding event_encoding_;
     std::unique_ptr<MessageQueue> message_queue_;
+    std::unique_ptr<RetryScheduler> retry_scheduler_;
     std::atomic_bool running_{true};
 };
 
@@ -4,6 +4,9 @@
 #include <string>
 #include <functional>
 #include <atomic>
+#include <cstdint>
+#include <vector>
+#include <unordered_set>
 #include <amqp.h>
 
 struct MessageQueueConfig {
@@ -11,6 +14,8 @@ struct MessageQueueConfig {
     std::string port;
     std::string user;
     std::string password;
+    // Deliveries the broker may have outstanding on a consumer before it acks; 0 is unlimited.
+    std::uint16_t prefetch{0};
 };
 
 class MessageQueue {
@@ -18,12 +23,29 @@ public:
     explicit MessageQueue(const MessageQueueConfig& config);
     ~MessageQueue();
 
-    void publish(const std::string& queue, const std::string& message);
-    void consume(const std::string& queue, std::function<void(const std::string&)> callback, std::atomic_bool& running);
+    // Handler receives one event and its AMQP content type (empty when the publisher set none);
+    // a batch envelope calls it once per event and is acknowledged after the last one.
+    using MessageHandler = std::function<void(const std::string&, const std::string&)>;
+    // Receives every event of one delivery at once, with the delivery's content type.
+    using BatchHandler = std::function<void(const std::vector<std::string>&, const std::string&)>;
+
+    // batch marks message as an envelope built with event_batch::append.
+    void publish(const std::string& queue, const std::string& message,
+                 const std::string& content_type = "application/json", bool batch = false);
+    // Declares the exchange on first use, then publishes with the given routing key.
+    void publish_to_exchange(const std::string& exchange, const std::string& routing_key,
+                             const std::string& message, const std::string& content_type = "application/json",
+                             bool batch = false, const std::string& exchange_type = "topic");
+    // A delivery whose handler throws is requeued and consumption pauses with a growing backoff,
+    // so an outage downstream of the handler does not spin on redeliveries.
+    void consume(const std::string& queue, MessageHandler callback, std::atomic_bool& running);
+    void consume_batches(const std::string& queue, BatchHandler callback, std::atomic_bool& running);
 
 private:
     amqp_connection_state_t connection_{};
     amqp_channel_t channel_{1};
+    std::uint16_t prefetch_{0};
+    std::unordered_set<std::string> declared_exchanges_;
 };
 
 #endif
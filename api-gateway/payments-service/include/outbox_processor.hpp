@@ -3,22 +3,64 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 #include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
 #include "database.hpp"
 #include "message_queue.hpp"
 
+struct OutboxProcessorConfig {
+    // Each worker owns the events whose aggregate_id hashes to its index, so per-order order is kept.
+    std::size_t workers{4};
+    std::size_t batch_size{10};
+    // How long a claimed batch stays invisible to other dispatchers; unpublished events reappear after it.
+    std::chrono::seconds lease{30};
+
+    // Opt-in batch envelopes: up to this many events bound for the same destination share one
+    // AMQP message (1 disables), capped at envelope_max_bytes of payload.
+    std::size_t envelope_max_events{1};
+    std::size_t envelope_max_bytes{64 * 1024};
+
+    // Payment results go to a topic exchange with routing key "order.<shard>", where the shard is a
+    // stable hash of the order ID; every websocket-service instance binds its own queue to it.
+    std::string results_exchange{"payment.results"};
+    std::size_t routing_shards{16};
+};
+
 class OutboxProcessor {
 public:
-    OutboxProcessor(std::shared_ptr<Database> db, const MessageQueueConfig& mq_config);
+    using DatabaseFactory = std::function<std::shared_ptr<Database>()>;
+
+    OutboxProcessor(const DatabaseFactory& connect_db, const MessageQueueConfig& mq_config,
+                    OutboxProcessorConfig config = {});
     void run();
     void stop();
 
 private:
-    void process_pending_events();
+    struct Worker {
+        std::size_t index{};
+        std::shared_ptr<Database> db;
+        std::unique_ptr<MessageQueue> message_queue;
+    };
+
+    struct ClaimedEvent {
+        std::string id;
+        std::string type;
+        std::string payload;
+        std::string content_type;
+        std::string aggregate_id;
+    };
+
+    void run_worker(Worker& worker);
+    std::size_t process_pending_events(Worker& worker);
+    std::vector<ClaimedEvent> claim_batch(Worker& worker, const std::string& claim_token);
+    std::string result_routing_key(const std::string& order_id) const;
 
-    std::shared_ptr<Database> db_;
     MessageQueueConfig mq_config_;
-    std::unique_ptr<MessageQueue> message_queue_;
+    OutboxProcessorConfig config_;
+    std::vector<Worker> workers_;
     std::atomic_bool running_{true};
 };
 
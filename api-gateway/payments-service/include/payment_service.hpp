@@ -5,19 +5,20 @@
 #include <string>
 #include "models.hpp"
 #include "database.hpp"
+#include "shard_map.hpp"
 
 class PaymentService {
 public:
-    explicit PaymentService(std::shared_ptr<Database> db);
+    // Every call runs on the shard that owns the user's account.
+    explicit PaymentService(std::shared_ptr<ShardRouter> shards);
 
     models::Account create_account(const std::string& user_id);
     models::Account get_account(const std::string& user_id);
     models::Account deposit(const std::string& user_id, double amount);
-    bool process_payment(const std::string& user_id, const std::string& order_id, double amount);
     double get_balance(const std::string& user_id);
 
 private:
-    std::shared_ptr<Database> db_;
+    std::shared_ptr<ShardRouter> shards_;
 };
 
 #endif
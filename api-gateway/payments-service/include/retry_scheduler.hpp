@@ -0,0 +1,70 @@
+#ifndef RETRY_SCHEDULER_HPP
+#define RETRY_SCHEDULER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include "message_queue.hpp"
+#include "shard_map.hpp"
+#include "timer_wheel.hpp"
+
+struct RetryConfig {
+    // After this many failed retries the message is parked as DEAD and sent to dead_letter_queue.
+    int max_retries{5};
+    // Retry n waits base_delay * 2^n, capped at max_delay.
+    std::chrono::milliseconds base_delay{1000};
+    std::chrono::milliseconds max_delay{5 * 60 * 1000};
+    std::chrono::milliseconds tick{100};
+    std::size_t wheel_slots{512};
+    // How often the shards are scanned for RETRY rows overdue by more than this long and not
+    // armed here, e.g. rows left behind by a replica that died.
+    std::chrono::milliseconds rescan_interval{30 * 1000};
+    std::string dead_letter_queue{"payment.requests.dlq"};
+};
+
+// Re-drives inbox rows left in status RETRY by a failed delivery, off the consumer thread, so
+// a poison message costs one failed attempt per backoff step instead of a requeue loop. The
+// rows carry retry_count and next_attempt_at, so pending retries survive a restart, and any
+// replica picks up overdue rows that no replica is holding.
+class RetryScheduler {
+public:
+    // Reprocesses one stored message; throwing counts as another failed attempt.
+    using Redrive = std::function<void(ShardRouter&, const std::string& payload, const std::string& content_type)>;
+
+    RetryScheduler(std::shared_ptr<ShardRouter> shards, const MessageQueueConfig& mq_config,
+                   RetryConfig config, Redrive redrive);
+
+    // Thread-safe; the row must already be stored on the given shard.
+    void schedule(std::size_t shard, const std::string& event_id, std::chrono::milliseconds delay);
+
+    void run(const std::atomic_bool& running);
+
+    std::chrono::milliseconds delay_for(int retry_count) const;
+
+private:
+    struct Due {
+        std::size_t shard;
+        std::string event_id;
+    };
+
+    void load_pending();
+    void rescan_overdue();
+    void attempt(const Due& due);
+
+    std::shared_ptr<ShardRouter> shards_;
+    RetryConfig config_;
+    Redrive redrive_;
+    std::unique_ptr<MessageQueue> message_queue_;
+
+    std::mutex mutex_;
+    TimerWheel<Due> wheel_;
+    // (shard, event_id) of every row waiting in wheel_.
+    std::set<std::pair<std::size_t, std::string>> armed_;
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef SHARD_MAP_HPP
+#define SHARD_MAP_HPP
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include "database.hpp"
+
+struct ShardConfig {
+    std::string name;
+    std::string host;
+    std::string port;
+    std::string dbname;
+    std::string user;
+    std::string password;
+    // Optional read replica for this shard (see Database::attach_replica).
+    std::string replica_host;
+};
+
+// Accounts hash into a fixed number of buckets with utils::stable_hash(user_id), and each
+// bucket belongs to one shard. Rebalancing moves bucket ownership, never the hash, so only
+// the accounts of moved buckets change database.
+//
+// File format:
+//   {
+//     "buckets": 1024,
+//     "shards": [
+//       {"name": "payments-0", "host": "...", "port": "5432", "dbname": "payments_db",
+//        "user": "...", "password": "...", "replica_host": "", "buckets": [[0, 511]]},
+//       ...
+//     ]
+//   }
+// "buckets" ranges are inclusive; if no shard lists any, buckets are split evenly.
+class ShardMap {
+public:
+    ShardMap(std::vector<ShardConfig> shards, std::vector<std::size_t> bucket_owner);
+
+    static ShardMap from_file(const std::string& path);
+    // Every bucket on one database; the unsharded deployment.
+    static ShardMap single(ShardConfig shard);
+
+    std::size_t bucket_of(const std::string& user_id) const;
+    std::size_t shard_of(const std::string& user_id) const;
+    std::size_t shard_of_bucket(std::size_t bucket) const;
+    std::size_t bucket_count() const { return bucket_owner_.size(); }
+
+    const std::vector<ShardConfig>& shards() const { return shards_; }
+
+    std::shared_ptr<Database> connect(std::size_t shard) const;
+
+private:
+    std::vector<ShardConfig> shards_;
+    std::vector<std::size_t> bucket_owner_;
+};
+
+// One connection per shard, picked by user_id.
+class ShardRouter {
+public:
+    ShardRouter(const ShardMap& map, std::vector<std::shared_ptr<Database>> databases);
+
+    Database& for_user(const std::string& user_id) { return *databases_[map_.shard_of(user_id)]; }
+    Database& shard(std::size_t index) { return *databases_.at(index); }
+    std::size_t shard_of(const std::string& user_id) const { return map_.shard_of(user_id); }
+    std::size_t size() const { return databases_.size(); }
+
+private:
+    const ShardMap& map_;
+    std::vector<std::shared_ptr<Database>> databases_;
+};
+
+#endif
@@ -0,0 +1,33 @@
+#include "balance_snapshotter.hpp"
+#include <iostream>
+#include <thread>
+
+BalanceSnapshotter::BalanceSnapshotter(std::shared_ptr<Database> db, std::chrono::seconds interval)
+    : db_(std::move(db)), interval_(interval) {}
+
+void BalanceSnapshotter::run_once() {
+    auto result = db_->query("SELECT refresh_balance_snapshot()");
+    auto folded = result[0][0].as<int>();
+    if (folded > 0) {
+        std::cout << "Refreshed balance snapshot of " << folded << " account(s)" << std::endl;
+    }
+}
+
+void BalanceSnapshotter::run() {
+    while (running_.load()) {
+        try {
+            run_once();
+        } catch (const std::exception& e) {
+            std::cerr << "Balance snapshot error: " << e.what() << std::endl;
+        }
+
+        auto wake_at = std::chrono::steady_clock::now() + interval_;
+        while (running_.load() && std::chrono::steady_clock::now() < wake_at) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+    }
+}
+
+void BalanceSnapshotter::stop() {
+    running_.store(false);
+}
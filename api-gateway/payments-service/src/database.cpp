@@ -1,21 +1,31 @@
 #include "database.hpp"
+#include "partitioning.hpp"
 #include <stdexcept>
 
+static std::string connection_string(const std::string& host,
+                                     const std::string& port,
+                                     const std::string& dbname,
+                                     const std::string& user,
+                                     const std::string& password) {
+    return "host=" + host +
+           " port=" + port +
+           " dbname=" + dbname +
+           " user=" + user +
+           " password=" + password;
+}
+
 Database::Database(const std::string& host,
                    const std::string& port,
                    const std::string& dbname,
                    const std::string& user,
                    const std::string& password) {
-    std::string conn_str = "host=" + host +
-                          " port=" + port +
-                          " dbname=" + dbname +
-                          " user=" + user +
-                          " password=" + password;
+    auto conn_str = connection_string(host, port, dbname, user, password);
     try {
         conn_ = std::make_unique<pqxx::connection>(conn_str);
     } catch (const std::exception& e) {
         throw std::runtime_error("Failed to connect to database: " + std::string(e.what()));
     }
+    pipeline_ = std::make_unique<QueryPipeline>(conn_str);
 }
 
 pqxx::transaction_base& Database::begin_transaction() {
@@ -23,6 +33,19 @@ pqxx::transaction_base& Database::begin_transaction() {
     return *transaction_;
 }
 
+void Database::attach_replica(const std::string& host,
+                              const std::string& port,
+                              const std::string& dbname,
+                              const std::string& user,
+                              const std::string& password,
+                              std::chrono::milliseconds max_lag,
+                              std::chrono::milliseconds lag_check_interval) {
+    // An unreachable host must not stall readers for long.
+    replica_ = std::make_shared<ReadReplica>(
+        connection_string(host, port, dbname, user, password) + " connect_timeout=2",
+        max_lag, lag_check_interval);
+}
+
 pqxx::result Database::query(const std::string& sql) {
     pqxx::nontransaction nt(*conn_);
     return nt.exec(sql);
@@ -42,6 +65,41 @@ void Database::execute(pqxx::transaction_base& tx, const std::string& sql) {
     tx.exec(sql);
 }
 
+void Database::prepare(const std::string& name, const std::string& sql) {
+    conn_->prepare(name, sql);
+}
+
+std::string Database::array_literal(const std::vector<std::string>& values) {
+    std::string literal = "{";
+    for (const auto& value : values) {
+        if (literal.size() > 1) literal.push_back(',');
+        literal.push_back('"');
+        for (char c : value) {
+            if (c == '"' || c == '\\') literal.push_back('\\');
+            literal.push_back(c);
+        }
+        literal.push_back('"');
+    }
+    literal.push_back('}');
+    return literal;
+}
+
+// Event payloads used to be JSONB; they are bytea now so binary encodings fit. Existing rows
+// keep their JSON text and are tagged application/json by the content_type default.
+static void migrate_payload_to_bytea(Database& db, const std::string& table) {
+    db.execute(
+        "DO $$ "
+        "BEGIN "
+        "   IF EXISTS (SELECT 1 FROM information_schema.columns "
+        "              WHERE table_name = '" + table + "' AND column_name = 'payload' AND data_type = 'jsonb') THEN "
+        "       ALTER TABLE " + table + " ALTER COLUMN payload TYPE BYTEA USING convert_to(payload::text, 'UTF8'); "
+        "   END IF; "
+        "END $$"
+    );
+    db.execute("ALTER TABLE " + table + " ADD COLUMN IF NOT EXISTS content_type VARCHAR(100) "
+               "NOT NULL DEFAULT 'application/json'");
+}
+
 void Database::initialize_schema() {
     execute(
         "CREATE TABLE IF NOT EXISTS accounts ("
@@ -53,31 +111,160 @@ void Database::initialize_schema() {
         ")"
     );
 
+    // Money movements are appended here instead of rewriting the account row. accounts.balance
+    // and accounts.version are the balance snapshot: they include every entry written by a
+    // transaction older than balance_snapshot.horizon, and the current balance adds the newer
+    // entries on top (see PaymentService). txid is the writing transaction, so the horizon can
+    // be taken from a snapshot's xmin without missing entries that commit out of id order.
     execute(
-        "CREATE TABLE IF NOT EXISTS inbox_events ("
-        "   id VARCHAR(255) PRIMARY KEY,"
-        "   type VARCHAR(100) NOT NULL,"
-        "   payload JSONB NOT NULL,"
-        "   status VARCHAR(50) NOT NULL DEFAULT 'PENDING',"
-        "   processed_at TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP,"
-        "   retry_count INTEGER NOT NULL DEFAULT 0"
+        "CREATE TABLE IF NOT EXISTS ledger_entries ("
+        "   id BIGSERIAL PRIMARY KEY,"
+        "   user_id VARCHAR(255) NOT NULL,"
+        "   amount DECIMAL(10,2) NOT NULL,"
+        "   kind VARCHAR(50) NOT NULL,"
+        "   reference VARCHAR(255),"
+        "   txid BIGINT NOT NULL DEFAULT txid_current(),"
+        "   created_at TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP"
         ")"
     );
+    execute("CREATE INDEX IF NOT EXISTS idx_ledger_user_txid ON ledger_entries(user_id, txid) INCLUDE (amount)");
+    execute("CREATE INDEX IF NOT EXISTS idx_ledger_txid ON ledger_entries(txid)");
 
     execute(
-        "CREATE TABLE IF NOT EXISTS outbox_events ("
-        "   id VARCHAR(255) PRIMARY KEY,"
-        "   type VARCHAR(100) NOT NULL,"
-        "   payload JSONB NOT NULL,"
-        "   status VARCHAR(50) NOT NULL DEFAULT 'PENDING',"
-        "   created_at TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP"
+        "CREATE TABLE IF NOT EXISTS balance_snapshot ("
+        "   id BOOLEAN PRIMARY KEY DEFAULT TRUE CHECK (id),"
+        "   horizon BIGINT NOT NULL,"
+        "   refreshed_at TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP"
         ")"
     );
+    execute("INSERT INTO balance_snapshot (horizon) VALUES (1) ON CONFLICT DO NOTHING");
+
+    // Folds entries below the current xmin into the account rows and advances the horizon.
+    // The row lock on balance_snapshot serialises concurrent refreshes. Returns the number of
+    // accounts updated.
+    execute(
+        "CREATE OR REPLACE FUNCTION refresh_balance_snapshot() "
+        "RETURNS integer AS $$ "
+        "DECLARE from_txid bigint; to_txid bigint; folded integer; "
+        "BEGIN "
+        "   SELECT horizon INTO from_txid FROM balance_snapshot FOR UPDATE; "
+        "   to_txid := txid_snapshot_xmin(txid_current_snapshot()); "
+        "   IF to_txid <= from_txid THEN "
+        "       RETURN 0; "
+        "   END IF; "
+        "   UPDATE accounts a SET balance = a.balance + p.total, version = a.version + p.entries "
+        "   FROM (SELECT user_id, sum(amount) AS total, count(*) AS entries FROM ledger_entries "
+        "         WHERE txid >= from_txid AND txid < to_txid GROUP BY user_id) p "
+        "   WHERE a.user_id = p.user_id; "
+        "   GET DIAGNOSTICS folded = ROW_COUNT; "
+        "   UPDATE balance_snapshot SET horizon = to_txid, refreshed_at = localtimestamp; "
+        "   RETURN folded; "
+        "END; "
+        "$$ language 'plpgsql'"
+    );
+
+    partitioning::install_functions(*this);
+
+    partitioning::create_partitioned_table(*this, "inbox_events",
+        "   id VARCHAR(255) NOT NULL,"
+        "   type VARCHAR(100) NOT NULL,"
+        "   payload BYTEA NOT NULL,"
+        "   status VARCHAR(50) NOT NULL DEFAULT 'PENDING',"
+        "   processed_at TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP,"
+        "   retry_count INTEGER NOT NULL DEFAULT 0,"
+        "   content_type VARCHAR(100) NOT NULL DEFAULT 'application/json',"
+        "   next_attempt_at TIMESTAMP,"
+        "   last_error TEXT,"
+        "   PRIMARY KEY (id, processed_at)",
+        "processed_at", 3);
+
+    partitioning::create_partitioned_table(*this, "outbox_events",
+        "   id VARCHAR(255) NOT NULL,"
+        "   type VARCHAR(100) NOT NULL,"
+        "   payload BYTEA NOT NULL,"
+        "   status VARCHAR(50) NOT NULL DEFAULT 'PENDING',"
+        "   created_at TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP,"
+        "   aggregate_id VARCHAR(255),"
+        "   claimed_until TIMESTAMP,"
+        "   claim_token VARCHAR(64),"
+        "   content_type VARCHAR(100) NOT NULL DEFAULT 'application/json',"
+        "   PRIMARY KEY (id, created_at)",
+        "created_at", 3);
 
     execute("CREATE INDEX IF NOT EXISTS idx_inbox_status ON inbox_events(status)");
+    migrate_payload_to_bytea(*this, "inbox_events");
+    execute("ALTER TABLE inbox_events ADD COLUMN IF NOT EXISTS next_attempt_at TIMESTAMP");
+    execute("ALTER TABLE inbox_events ADD COLUMN IF NOT EXISTS last_error TEXT");
+    execute("ALTER TABLE outbox_events ADD COLUMN IF NOT EXISTS aggregate_id VARCHAR(255)");
+    execute("ALTER TABLE outbox_events ADD COLUMN IF NOT EXISTS claimed_until TIMESTAMP");
+    execute("ALTER TABLE outbox_events ADD COLUMN IF NOT EXISTS claim_token VARCHAR(64)");
+    migrate_payload_to_bytea(*this, "outbox_events");
+
     execute("CREATE INDEX IF NOT EXISTS idx_outbox_status ON outbox_events(status)");
+    execute("CREATE INDEX IF NOT EXISTS idx_outbox_pending_aggregate "
+            "ON outbox_events(aggregate_id, created_at) WHERE status = 'PENDING'");
     execute("CREATE INDEX IF NOT EXISTS idx_inbox_id ON inbox_events(id)");
 
+    // One payment request end to end: dedupe, debit, inbox record and PAYMENT_RESULT outbox
+    // row in a single atomic call. The caller encodes both possible results up front, since
+    // the encoding (e.g. MessagePack) is not available in SQL. Debits of one account are
+    // serialised by an advisory lock so two cannot pass the same balance check. A RETRY row
+    // left by an earlier failed attempt is replaced. Returns PROCESSED, FAILED or DUPLICATE.
+    execute(
+        "CREATE OR REPLACE FUNCTION process_payment_request("
+        "   p_event_id text, p_order_id text, p_user_id text, p_amount numeric, "
+        "   p_payload bytea, p_content_type text, p_outbox_id text, "
+        "   p_success_payload bytea, p_failure_payload bytea, p_result_content_type text) "
+        "RETURNS text AS $$ "
+        "DECLARE available numeric; debited boolean; status text; "
+        "BEGIN "
+        "   PERFORM pg_advisory_xact_lock(hashtext('inbox_events:' || p_event_id)); "
+        "   IF EXISTS (SELECT 1 FROM inbox_events WHERE id = p_event_id AND status <> 'RETRY') THEN "
+        "       RETURN 'DUPLICATE'; "
+        "   END IF; "
+        "   DELETE FROM inbox_events WHERE id = p_event_id AND status = 'RETRY'; "
+        "   PERFORM pg_advisory_xact_lock(hashtext('accounts:' || p_user_id)); "
+        "   SELECT a.balance + COALESCE((SELECT sum(l.amount) FROM ledger_entries l "
+        "                                WHERE l.user_id = a.user_id AND l.txid >= s.horizon), 0) "
+        "   INTO available FROM accounts a, balance_snapshot s WHERE a.user_id = p_user_id; "
+        "   debited := p_amount > 0 AND available IS NOT NULL AND available >= p_amount; "
+        "   IF debited THEN "
+        "       INSERT INTO ledger_entries (user_id, amount, kind, reference) "
+        "       VALUES (p_user_id, -p_amount, 'PAYMENT', p_order_id); "
+        "   END IF; "
+        "   status := CASE WHEN debited THEN 'PROCESSED' ELSE 'FAILED' END; "
+        "   INSERT INTO inbox_events (id, type, payload, content_type, status, processed_at) "
+        "   VALUES (p_event_id, 'PAYMENT_REQUEST', p_payload, p_content_type, status, localtimestamp); "
+        "   INSERT INTO outbox_events (id, type, payload, content_type, status, created_at, aggregate_id) "
+        "   VALUES (p_outbox_id, 'PAYMENT_RESULT', "
+        "           CASE WHEN debited THEN p_success_payload ELSE p_failure_payload END, "
+        "           p_result_content_type, 'PENDING', localtimestamp, p_order_id); "
+        "   RETURN status; "
+        "END; "
+        "$$ language 'plpgsql'"
+    );
+
+    // Stores a request whose processing failed as a RETRY row for the retry scheduler, unless
+    // the event already has an inbox row. A successful retry replaces it with the final row
+    // (see process_payment_request).
+    execute(
+        "CREATE OR REPLACE FUNCTION schedule_inbox_retry("
+        "   p_event_id text, p_payload bytea, p_content_type text, p_error text, p_delay_ms bigint) "
+        "RETURNS boolean AS $$ "
+        "BEGIN "
+        "   PERFORM pg_advisory_xact_lock(hashtext('inbox_events:' || p_event_id)); "
+        "   IF EXISTS (SELECT 1 FROM inbox_events WHERE id = p_event_id) THEN "
+        "       RETURN false; "
+        "   END IF; "
+        "   INSERT INTO inbox_events (id, type, payload, content_type, status, processed_at, "
+        "                             retry_count, next_attempt_at, last_error) "
+        "   VALUES (p_event_id, 'PAYMENT_REQUEST', p_payload, p_content_type, 'RETRY', localtimestamp, "
+        "           0, localtimestamp + p_delay_ms * interval '1 millisecond', p_error); "
+        "   RETURN true; "
+        "END; "
+        "$$ language 'plpgsql'"
+    );
+
     execute(
         "CREATE OR REPLACE FUNCTION update_updated_at_column() "
         "RETURNS TRIGGER AS $$ "
@@ -1,88 +1,201 @@
 #include "inbox_processor.hpp"
 #include <nlohmann/json.hpp>
 #include <iostream>
-#include <chrono>
+#include <map>
+#include <thread>
+#include <utility>
 #include "utils.hpp"
 #include "models.hpp"
 
 using json = nlohmann::json;
 
-InboxProcessor::InboxProcessor(std::shared_ptr<Database> db,
+static const char* process_payment_request_sql =
+    "SELECT process_payment_request($1, $2, $3, $4::numeric, $5, $6, $7, $8, $9, $10)";
+
+static void prepare_statements(ShardRouter& shards) {
+    for (std::size_t i = 0; i < shards.size(); ++i) {
+        shards.shard(i).prepare("process_payment_request", process_payment_request_sql);
+    }
+}
+
+InboxProcessor::InboxProcessor(const ShardRouterFactory& connect_shards,
                                const MessageQueueConfig& mq_config,
-                               PaymentService& payment_service)
-    : db_(std::move(db)), mq_config_(mq_config),
-      payment_service_(payment_service) {
+                               RetryConfig retry_config,
+                               event_codec::Encoding event_encoding)
+    : shards_(connect_shards()), mq_config_(mq_config), event_encoding_(event_encoding) {
+    prepare_statements(*shards_);
     message_queue_ = std::make_unique<MessageQueue>(mq_config_);
+
+    auto retry_shards = connect_shards();
+    prepare_statements(*retry_shards);
+    retry_scheduler_ = std::make_unique<RetryScheduler>(retry_shards, mq_config_, std::move(retry_config),
+        [this](ShardRouter& shards, const std::string& payload, const std::string& content_type) {
+            apply(shards, payload, content_type);
+        });
 }
 
 void InboxProcessor::run() {
-    message_queue_->consume(
-        "payment.requests",
-        [this](const std::string& message) {
-            this->handle_payment_request(message);
-        },
-        running_
-    );
+    std::thread retry_thread([this]() { retry_scheduler_->run(running_); });
+
+    try {
+        message_queue_->consume_batches(
+            "payment.requests",
+            [this](const std::vector<std::string>& messages, const std::string& content_type) {
+                this->handle_payment_requests(messages, content_type);
+            },
+            running_
+        );
+    } catch (...) {
+        running_.store(false);
+        retry_thread.join();
+        throw;
+    }
+
+    retry_thread.join();
 }
 
 void InboxProcessor::stop() {
     running_.store(false);
 }
 
-void InboxProcessor::handle_payment_request(const std::string& message) {
-    try {
-        auto json_msg = json::parse(message);
-        auto payment_request = models::messages::PaymentRequest::from_json(json_msg);
-
-        auto event_id = payment_request.order_id;
-
-        auto existing = db_->query(
-            "SELECT id FROM inbox_events WHERE id = $1",
-            event_id
-        );
-
-        if (!existing.empty()) return;
-
-        auto& tx = db_->begin_transaction();
+void InboxProcessor::handle_payment_requests(const std::vector<std::string>& messages,
+                                             const std::string& content_type) {
+    if (messages.size() == 1) {
+        handle_payment_request(messages.front(), content_type);
+        return;
+    }
 
-        db_->execute(tx,
-            "INSERT INTO inbox_events (id, type, payload, status, processed_at) "
-            "VALUES ($1, 'PAYMENT_REQUEST', $2::jsonb, 'PENDING', to_timestamp($3))",
-            event_id, message,
-            static_cast<long long>(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()))
-        );
+    std::map<std::size_t, std::vector<std::pair<const std::string*, PaymentCall>>> by_shard;
+    for (const auto& message : messages) {
+        try {
+            auto call = payment_call(message, content_type);
+            auto shard = shards_->shard_of(call.user_id);
+            by_shard[shard].emplace_back(&message, std::move(call));
+        } catch (const std::exception&) {
+            // Unreadable; the single-request path stores it for retry and dead-lettering.
+            handle_payment_request(message, content_type);
+        }
+    }
 
-        bool success = payment_service_.process_payment(
-            payment_request.user_id,
-            payment_request.order_id,
-            payment_request.amount
-        );
+    for (const auto& [shard, calls] : by_shard) {
+        // Each call commits on its own, exactly as when sent one at a time.
+        QueryPipeline::Batch batch;
+        for (const auto& [message, call] : calls) {
+            batch.add(process_payment_request_sql,
+                call.event_id, call.order_id, call.user_id, call.amount,
+                QueryPipeline::Binary{call.payload}, call.content_type, call.outbox_id,
+                QueryPipeline::Binary{call.success_payload}, QueryPipeline::Binary{call.failure_payload},
+                call.result_content_type);
+        }
+
+        std::vector<QueryPipeline::Result> results;
+        try {
+            results = shards_->shard(shard).pipeline().run(batch);
+        } catch (const std::exception& e) {
+            // Some calls may have run; process_payment_request turns those into DUPLICATE.
+            std::cerr << "Payment pipeline failed, retrying requests one by one: " << e.what() << std::endl;
+            for (const auto& entry : calls) {
+                handle_payment_request(*entry.first, content_type);
+            }
+            continue;
+        }
+
+        for (std::size_t i = 0; i < calls.size(); ++i) {
+            if (results[i].ok()) continue;
+            std::cerr << "Failed to handle payment request: " << results[i].error << std::endl;
+            store_for_retry(*calls[i].first, content_type, results[i].error);
+        }
+    }
+}
 
-        std::string status = success ? "PROCESSED" : "FAILED";
+void InboxProcessor::handle_payment_request(const std::string& message, const std::string& content_type) {
+    try {
+        apply(*shards_, message, content_type);
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to handle payment request: " << e.what() << std::endl;
+        // If even this fails (database down), the exception requeues the delivery and the
+        // consumer backs off before taking the next one.
+        store_for_retry(message, content_type, e.what());
+    }
+}
 
-        db_->execute(tx,
-            "UPDATE inbox_events SET status = $1 WHERE id = $2",
-            status, event_id
-        );
+InboxProcessor::PaymentCall InboxProcessor::payment_call(const std::string& message,
+                                                         const std::string& content_type) const {
+    auto encoding = event_codec::from_content_type(content_type);
+    auto json_msg = event_codec::decode(message, encoding);
+    auto payment_request = models::messages::PaymentRequest::from_json(json_msg);
+
+    models::messages::PaymentResult result;
+    result.order_id = payment_request.order_id;
+    result.user_id = payment_request.user_id;
+
+    PaymentCall call;
+    call.event_id = payment_request.order_id;
+    call.order_id = payment_request.order_id;
+    call.user_id = payment_request.user_id;
+    call.amount = payment_request.amount;
+    call.payload = message;
+    call.content_type = event_codec::content_type(encoding);
+    call.outbox_id = utils::generate_uuid();
+
+    result.success = true;
+    result.message = "Payment successful";
+    call.success_payload = event_codec::encode(result.to_json(), event_encoding_);
+
+    result.success = false;
+    result.message = "Payment failed";
+    call.failure_payload = event_codec::encode(result.to_json(), event_encoding_);
+
+    call.result_content_type = event_codec::content_type(event_encoding_);
+    return call;
+}
 
-        models::messages::PaymentResult result;
-        result.order_id = payment_request.order_id;
-        result.user_id = payment_request.user_id;
-        result.success = success;
-        result.message = success ? "Payment successful" : "Payment failed";
+void InboxProcessor::apply(ShardRouter& shards, const std::string& message, const std::string& content_type) {
+    auto call = payment_call(message, content_type);
+
+    // Dedupe, debit, inbox and outbox writes all happen inside process_payment_request;
+    // a redelivered request comes back as DUPLICATE without touching anything.
+    shards.for_user(call.user_id).query_prepared("process_payment_request",
+        call.event_id,
+        call.order_id,
+        call.user_id,
+        call.amount,
+        pqxx::binarystring(call.payload),
+        call.content_type,
+        call.outbox_id,
+        pqxx::binarystring(call.success_payload),
+        pqxx::binarystring(call.failure_payload),
+        call.result_content_type
+    );
+}
 
-        auto outbox_id = utils::generate_uuid();
+void InboxProcessor::store_for_retry(const std::string& message, const std::string& content_type,
+                                     const std::string& error) {
+    // The row lives with the account when the request can be read at all; an undecodable
+    // message gets an ID of its own and ends up dead-lettered.
+    std::size_t shard = 0;
+    std::string event_id;
+    try {
+        auto json_msg = event_codec::decode(message, event_codec::from_content_type(content_type));
+        auto payment_request = models::messages::PaymentRequest::from_json(json_msg);
+        shard = shards_->shard_of(payment_request.user_id);
+        event_id = payment_request.order_id;
+    } catch (const std::exception&) {
+        event_id = utils::generate_uuid();
+    }
 
-        db_->execute(tx,
-            "INSERT INTO outbox_events (id, type, payload, status, created_at) "
-            "VALUES ($1, 'PAYMENT_RESULT', $2::jsonb, 'PENDING', to_timestamp($3))",
-            outbox_id, result.to_json().dump(),
-            static_cast<long long>(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()))
-        );
+    auto delay = retry_scheduler_->delay_for(0);
+    auto stored = shards_->shard(shard).query(
+        "SELECT schedule_inbox_retry($1, $2, $3, $4, $5)",
+        event_id,
+        pqxx::binarystring(message),
+        content_type,
+        error,
+        static_cast<long long>(delay.count())
+    );
 
-        tx.commit();
-        db_->commit();
-    } catch (const std::exception& e) {
-        std::cerr << "Failed to handle payment request: " << e.what() << std::endl;
+    // false: the event already has an inbox row, so it is processed or already scheduled.
+    if (stored[0][0].as<bool>()) {
+        retry_scheduler_->schedule(shard, event_id, delay);
     }
 }
@@ -1,13 +1,21 @@
+#include <algorithm>
 #include <iostream>
 #include <thread>
 #include <memory>
 #include <cstdlib>
+#include <chrono>
+#include <vector>
 #include <httplib.h>
 #include <nlohmann/json.hpp>
 #include "database.hpp"
 #include "payment_service.hpp"
 #include "inbox_processor.hpp"
 #include "outbox_processor.hpp"
+#include "partitioning.hpp"
+#include "event_codec.hpp"
+#include "http_rate_limit.hpp"
+#include "shard_map.hpp"
+#include "balance_snapshotter.hpp"
 
 using json = nlohmann::json;
 using namespace httplib;
@@ -17,17 +25,69 @@ static const char* env_or(const char* key, const char* def_val) {
     return v ? v : def_val;
 }
 
+static RateLimit rate_limit_env(const std::string& prefix, const char* rate, const char* burst) {
+    return RateLimit{std::stod(env_or((prefix + "_RPS").c_str(), rate)),
+                     std::stod(env_or((prefix + "_BURST").c_str(), burst))};
+}
+
 int main() {
     try {
-        auto db = std::make_shared<Database>(
-            env_or("DB_HOST", "localhost"),
-            env_or("DB_PORT", "5432"),
-            env_or("DB_NAME", "payments_db"),
-            env_or("DB_USER", "microservice"),
-            env_or("DB_PASSWORD", "password")
-        );
+        // Without PAYMENT_SHARD_MAP every account lives on the single DB_* database.
+        auto shard_map_path = std::string(env_or("PAYMENT_SHARD_MAP", ""));
+        auto shard_map = shard_map_path.empty()
+            ? ShardMap::single(ShardConfig{
+                  "default",
+                  env_or("DB_HOST", "localhost"),
+                  env_or("DB_PORT", "5432"),
+                  env_or("DB_NAME", "payments_db"),
+                  env_or("DB_USER", "microservice"),
+                  env_or("DB_PASSWORD", "password"),
+                  env_or("DB_REPLICA_HOST", "")})
+            : ShardMap::from_file(shard_map_path);
+        const auto& shards = shard_map.shards();
+
+        // Every background thread gets its own connections; pqxx connections are not thread-safe.
+        auto connect_shards = [&shard_map]() {
+            std::vector<std::shared_ptr<Database>> databases;
+            for (std::size_t i = 0; i < shard_map.shards().size(); ++i) {
+                databases.push_back(shard_map.connect(i));
+            }
+            return std::make_shared<ShardRouter>(shard_map, std::move(databases));
+        };
 
-        db->initialize_schema();
+        auto http_shards = connect_shards();
+        for (std::size_t i = 0; i < shards.size(); ++i) {
+            auto& db = http_shards->shard(i);
+            db.initialize_schema();
+
+            // Optional: read-only endpoints use the replica while its lag stays under the limit.
+            if (!shards[i].replica_host.empty()) {
+                db.attach_replica(
+                    shards[i].replica_host,
+                    env_or("DB_REPLICA_PORT", shards[i].port.c_str()),
+                    env_or("DB_REPLICA_NAME", shards[i].dbname.c_str()),
+                    env_or("DB_REPLICA_USER", shards[i].user.c_str()),
+                    env_or("DB_REPLICA_PASSWORD", shards[i].password.c_str()),
+                    std::chrono::milliseconds(std::stoi(env_or("DB_REPLICA_MAX_LAG_MS", "1000"))),
+                    std::chrono::milliseconds(std::stoi(env_or("DB_REPLICA_LAG_CHECK_MS", "1000"))));
+            }
+        }
+
+        std::vector<std::unique_ptr<PartitionMaintainer>> partition_maintainers;
+        for (std::size_t i = 0; i < shards.size(); ++i) {
+            partition_maintainers.push_back(std::make_unique<PartitionMaintainer>(shard_map.connect(i),
+                std::vector<PartitionedTable>{{"inbox_events", "status IN ('PENDING', 'RETRY')"}, {"outbox_events", "status = 'PENDING'"}},
+                std::stoi(env_or("PARTITION_RETENTION_DAYS", "7")),
+                std::stoi(env_or("PARTITION_DAYS_AHEAD", "3")),
+                std::chrono::seconds(std::stoi(env_or("PARTITION_MAINTENANCE_INTERVAL", "3600")))));
+            partition_maintainers.back()->run_once();
+        }
+
+        std::vector<std::unique_ptr<BalanceSnapshotter>> balance_snapshotters;
+        for (std::size_t i = 0; i < shards.size(); ++i) {
+            balance_snapshotters.push_back(std::make_unique<BalanceSnapshotter>(shard_map.connect(i),
+                std::chrono::seconds(std::stoi(env_or("BALANCE_SNAPSHOT_INTERVAL", "10")))));
+        }
 
         auto mq_config = MessageQueueConfig{
             env_or("RABBITMQ_HOST", "localhost"),
@@ -36,19 +96,72 @@ int main() {
             env_or("RABBITMQ_PASS", "password")
         };
 
-        PaymentService payment_service(db);
-        InboxProcessor inbox_processor(db, mq_config, payment_service);
-        OutboxProcessor outbox_processor(db, mq_config);
-
-        std::thread inbox_thread([&inbox_processor]() { inbox_processor.run(); });
-        std::thread outbox_thread([&outbox_processor]() { outbox_processor.run(); });
+        PaymentService payment_service(http_shards);
+        // Consumers decode by content type, so this only chooses what this service produces.
+        auto event_encoding = event_codec::parse_encoding(env_or("EVENT_ENCODING", "json"));
+
+        // Failed payment requests are retried with exponential backoff, then dead-lettered.
+        RetryConfig retry_config;
+        retry_config.max_retries = std::stoi(env_or("INBOX_RETRY_MAX", "5"));
+        retry_config.base_delay = std::chrono::milliseconds(std::stoi(env_or("INBOX_RETRY_BASE_DELAY_MS", "1000")));
+        retry_config.max_delay = std::chrono::milliseconds(std::stoi(env_or("INBOX_RETRY_MAX_DELAY_MS", "300000")));
+        retry_config.rescan_interval = std::chrono::milliseconds(std::stoi(env_or("INBOX_RETRY_RESCAN_MS", "30000")));
+        retry_config.dead_letter_queue = env_or("INBOX_DEAD_LETTER_QUEUE", "payment.requests.dlq");
+        // Bounds how many requests the broker pushes ahead of the acks, so a stalled inbox
+        // leaves the rest on the queue instead of buffered in this process.
+        auto inbox_mq_config = mq_config;
+        inbox_mq_config.prefetch = static_cast<std::uint16_t>(std::stoul(env_or("INBOX_PREFETCH", "32")));
+        InboxProcessor inbox_processor(connect_shards, inbox_mq_config, retry_config, event_encoding);
+
+        OutboxProcessorConfig outbox_config;
+        outbox_config.workers = std::stoul(env_or("OUTBOX_WORKERS", "4"));
+        outbox_config.batch_size = std::stoul(env_or("OUTBOX_BATCH_SIZE", "10"));
+        outbox_config.lease = std::chrono::seconds(std::stoi(env_or("OUTBOX_LEASE_SECONDS", "30")));
+        outbox_config.envelope_max_events = std::stoul(env_or("OUTBOX_ENVELOPE_MAX_EVENTS", "1"));
+        outbox_config.envelope_max_bytes = std::stoul(env_or("OUTBOX_ENVELOPE_MAX_BYTES", "65536"));
+        outbox_config.results_exchange = env_or("PAYMENT_RESULTS_EXCHANGE", "payment.results");
+        outbox_config.routing_shards = std::stoul(env_or("PAYMENT_RESULTS_SHARDS", "16"));
+
+        // Each shard has its own outbox, drained by its own dispatchers.
+        std::vector<std::unique_ptr<OutboxProcessor>> outbox_processors;
+        for (std::size_t i = 0; i < shards.size(); ++i) {
+            outbox_processors.push_back(std::make_unique<OutboxProcessor>(
+                [&shard_map, i]() { return shard_map.connect(i); }, mq_config, outbox_config));
+        }
+
+        std::thread inbox_thread([&inbox_processor]() {
+            try {
+                inbox_processor.run();
+            } catch (const std::exception& e) {
+                std::cerr << "Inbox processor stopped: " << e.what() << std::endl;
+            }
+        });
+        std::vector<std::thread> background_threads;
+        for (auto& processor : outbox_processors) {
+            background_threads.emplace_back([&processor]() { processor->run(); });
+        }
+        for (auto& maintainer : partition_maintainers) {
+            background_threads.emplace_back([&maintainer]() { maintainer->run(); });
+        }
+        for (auto& snapshotter : balance_snapshotters) {
+            background_threads.emplace_back([&snapshotter]() { snapshotter->run(); });
+        }
+
+        // Per-user budgets; RATE_LIMIT_<ROUTE>_RPS=0 turns a route's limit off.
+        RateLimiter rate_limiter;
+        rate_limiter.set_limit("create_account", rate_limit_env("RATE_LIMIT_CREATE_ACCOUNT", "1", "5"));
+        rate_limiter.set_limit("deposit", rate_limit_env("RATE_LIMIT_DEPOSIT", "5", "10"));
+        rate_limiter.set_limit("read_balance", rate_limit_env("RATE_LIMIT_READ_BALANCE", "50", "100"));
 
         Server svr;
 
-        svr.Post("/api/accounts", [&payment_service](const Request& req, Response& res) {
+        svr.Post("/api/accounts", [&payment_service, &rate_limiter](const Request& req, Response& res) {
+            if (!rate_limit::admit_body_user(rate_limiter, "create_account", req, res)) return;
+
             try {
                 auto json_body = json::parse(req.body);
                 auto user_id = json_body.at("user_id").get<std::string>();
+                if (!rate_limit::admit_parsed_user(rate_limiter, "create_account", req, user_id, res)) return;
 
                 auto account = payment_service.create_account(user_id);
                 res.set_content(account.to_json().dump(), "application/json");
@@ -60,9 +173,11 @@ int main() {
             }
         });
 
-        svr.Post(R"(/api/accounts/([A-Za-z0-9\-]+)/deposit)", [&payment_service](const Request& req, Response& res) {
+        svr.Post(R"(/api/accounts/([A-Za-z0-9\-]+)/deposit)", [&payment_service, &rate_limiter](const Request& req, Response& res) {
+            auto user_id = req.matches[1].str();
+            if (!rate_limit::admit(rate_limiter, "deposit", rate_limit::user_key(req, user_id), res)) return;
+
             try {
-                auto user_id = req.matches[1].str();
                 auto json_body = json::parse(req.body);
                 auto amount = json_body.at("amount").get<double>();
 
@@ -75,9 +190,11 @@ int main() {
             }
         });
 
-        svr.Get(R"(/api/accounts/([A-Za-z0-9\-]+)/balance)", [&payment_service](const Request& req, Response& res) {
+        svr.Get(R"(/api/accounts/([A-Za-z0-9\-]+)/balance)", [&payment_service, &rate_limiter](const Request& req, Response& res) {
+            auto user_id = req.matches[1].str();
+            if (!rate_limit::admit(rate_limiter, "read_balance", rate_limit::user_key(req, user_id), res)) return;
+
             try {
-                auto user_id = req.matches[1].str();
                 auto balance = payment_service.get_balance(user_id);
 
                 json response = {{"user_id", user_id}, {"balance", balance}};
@@ -93,13 +210,19 @@ int main() {
             res.set_content("OK", "text/plain");
         });
 
+        svr.Get("/metrics/rate-limits", [&rate_limiter](const Request&, Response& res) {
+            res.set_content(rate_limiter.stats().dump(), "application/json");
+        });
+
         std::cout << "Payments Service starting on port 8080..." << std::endl;
         svr.listen("0.0.0.0", 8080);
 
         inbox_processor.stop();
-        outbox_processor.stop();
+        for (auto& processor : outbox_processors) processor->stop();
+        for (auto& maintainer : partition_maintainers) maintainer->stop();
+        for (auto& snapshotter : balance_snapshotters) snapshotter->stop();
         inbox_thread.join();
-        outbox_thread.join();
+        for (auto& t : background_threads) t.join();
     } catch (const std::exception& e) {
         std::cerr << "Fatal error: " << e.what() << std::endl;
         return 1;
@@ -1,6 +1,11 @@
 #include "message_queue.hpp"
 #include <amqp_tcp_socket.h>
+#include <algorithm>
+#include <chrono>
 #include <stdexcept>
+#include <iostream>
+#include <thread>
+#include "event_batch.hpp"
 
 static void ensure_ok(const amqp_rpc_reply_t& reply, const char* what) {
     if (reply.reply_type != AMQP_RESPONSE_NORMAL) {
@@ -8,7 +13,32 @@ static void ensure_ok(const amqp_rpc_reply_t& reply, const char* what) {
     }
 }
 
-MessageQueue::MessageQueue(const MessageQueueConfig& config) {
+static std::string content_type_of(const amqp_envelope_t& envelope) {
+    const auto& props = envelope.message.properties;
+    if (!(props._flags & AMQP_BASIC_CONTENT_TYPE_FLAG)) return {};
+    return std::string(static_cast<char*>(props.content_type.bytes), props.content_type.len);
+}
+
+static bool is_event_batch(const amqp_envelope_t& envelope) {
+    const auto& props = envelope.message.properties;
+    if (!(props._flags & AMQP_BASIC_TYPE_FLAG)) return false;
+    return std::string(static_cast<char*>(props.type.bytes), props.type.len) == event_batch::message_type();
+}
+
+// One entry per event carried by the delivery; a malformed envelope yields none.
+static std::vector<std::string> events_of(const amqp_envelope_t& envelope) {
+    std::string body(static_cast<char*>(envelope.message.body.bytes), envelope.message.body.len);
+    if (!is_event_batch(envelope)) return {std::move(body)};
+
+    try {
+        return event_batch::unpack(body);
+    } catch (const std::exception& e) {
+        std::cerr << "Dropping malformed event batch: " << e.what() << std::endl;
+        return {};
+    }
+}
+
+MessageQueue::MessageQueue(const MessageQueueConfig& config) : prefetch_(config.prefetch) {
     connection_ = amqp_new_connection();
     if (!connection_) {
         throw std::runtime_error("Cannot create RabbitMQ connection");
@@ -48,7 +78,8 @@ MessageQueue::~MessageQueue() {
     }
 }
 
-void MessageQueue::publish(const std::string& queue, const std::string& message) {
+void MessageQueue::publish(const std::string& queue, const std::string& message,
+                           const std::string& content_type, bool batch) {
     amqp_bytes_t queue_bytes = amqp_cstring_bytes(queue.c_str());
 
     amqp_queue_declare(connection_, channel_, queue_bytes, 0, 1, 0, 0, amqp_empty_table);
@@ -62,7 +93,11 @@ void MessageQueue::publish(const std::string& queue, const std::string& message)
     amqp_basic_properties_t props;
     props._flags = AMQP_BASIC_DELIVERY_MODE_FLAG | AMQP_BASIC_CONTENT_TYPE_FLAG;
     props.delivery_mode = 2;
-    props.content_type = amqp_cstring_bytes("application/json");
+    props.content_type = amqp_cstring_bytes(content_type.c_str());
+    if (batch) {
+        props._flags |= AMQP_BASIC_TYPE_FLAG;
+        props.type = amqp_cstring_bytes(event_batch::message_type());
+    }
 
     int result = amqp_basic_publish(connection_, channel_, amqp_cstring_bytes(""),
                                     queue_bytes, 0, 0, &props, body);
@@ -71,19 +106,74 @@ void MessageQueue::publish(const std::string& queue, const std::string& message)
     }
 }
 
+void MessageQueue::publish_to_exchange(const std::string& exchange, const std::string& routing_key,
+                                       const std::string& message, const std::string& content_type,
+                                       bool batch, const std::string& exchange_type) {
+    amqp_bytes_t exchange_bytes = amqp_cstring_bytes(exchange.c_str());
+
+    if (declared_exchanges_.count(exchange) == 0) {
+        amqp_exchange_declare(connection_, channel_, exchange_bytes, amqp_cstring_bytes(exchange_type.c_str()),
+                              0, 1, 0, 0, amqp_empty_table);
+        auto reply = amqp_get_rpc_reply(connection_);
+        ensure_ok(reply, "exchange_declare");
+        declared_exchanges_.insert(exchange);
+    }
+
+    amqp_bytes_t body;
+    body.len = message.size();
+    body.bytes = const_cast<char*>(message.data());
+
+    amqp_basic_properties_t props;
+    props._flags = AMQP_BASIC_DELIVERY_MODE_FLAG | AMQP_BASIC_CONTENT_TYPE_FLAG;
+    props.delivery_mode = 2;
+    props.content_type = amqp_cstring_bytes(content_type.c_str());
+    if (batch) {
+        props._flags |= AMQP_BASIC_TYPE_FLAG;
+        props.type = amqp_cstring_bytes(event_batch::message_type());
+    }
+
+    int result = amqp_basic_publish(connection_, channel_, exchange_bytes,
+                                    amqp_cstring_bytes(routing_key.c_str()), 0, 0, &props, body);
+    if (result < 0) {
+        throw std::runtime_error("Failed to publish message");
+    }
+}
+
 void MessageQueue::consume(const std::string& queue,
-                           std::function<void(const std::string&)> callback,
+                           MessageHandler callback,
                            std::atomic_bool& running) {
+    consume_batches(queue,
+        [&callback](const std::vector<std::string>& events, const std::string& content_type) {
+            for (const auto& event : events) {
+                callback(event, content_type);
+            }
+        },
+        running);
+}
+
+void MessageQueue::consume_batches(const std::string& queue,
+                                   BatchHandler callback,
+                                   std::atomic_bool& running) {
     amqp_bytes_t queue_bytes = amqp_cstring_bytes(queue.c_str());
 
     amqp_queue_declare(connection_, channel_, queue_bytes, 0, 1, 0, 0, amqp_empty_table);
     auto reply = amqp_get_rpc_reply(connection_);
     ensure_ok(reply, "queue_declare");
 
-    amqp_basic_consume(connection_, channel_, queue_bytes, amqp_empty_bytes, 0, 1, 0, amqp_empty_table);
+    if (prefetch_ > 0) {
+        amqp_basic_qos(connection_, channel_, 0, prefetch_, 0);
+        reply = amqp_get_rpc_reply(connection_);
+        ensure_ok(reply, "basic_qos");
+    }
+
+    amqp_basic_consume(connection_, channel_, queue_bytes, amqp_empty_bytes, 0, 0, 0, amqp_empty_table);
     reply = amqp_get_rpc_reply(connection_);
     ensure_ok(reply, "basic_consume");
 
+    const std::chrono::milliseconds min_backoff(500);
+    const std::chrono::milliseconds max_backoff(30000);
+    std::chrono::milliseconds backoff(0);
+
     while (running.load()) {
         amqp_envelope_t envelope;
         amqp_maybe_release_buffers(connection_);
@@ -94,9 +184,41 @@ void MessageQueue::consume(const std::string& queue,
 
         amqp_rpc_reply_t ret = amqp_consume_message(connection_, &envelope, &timeout, 0);
         if (ret.reply_type == AMQP_RESPONSE_NORMAL) {
-            std::string msg(static_cast<char*>(envelope.message.body.bytes), envelope.message.body.len);
-            callback(msg);
+            auto content_type = content_type_of(envelope);
+            auto delivery_tag = envelope.delivery_tag;
+            auto events = events_of(envelope);
             amqp_destroy_envelope(&envelope);
+
+            std::string error;
+            try {
+                if (!events.empty()) callback(events, content_type);
+            } catch (const std::exception& e) {
+                error = e.what();
+            } catch (...) {
+                error = "unknown error";
+            }
+
+            if (error.empty()) {
+                if (amqp_basic_ack(connection_, channel_, delivery_tag, 0) != AMQP_STATUS_OK) {
+                    throw std::runtime_error("Failed to ack message");
+                }
+                backoff = std::chrono::milliseconds(0);
+                continue;
+            }
+
+            // Events of a batch handled before the failure are seen again on redelivery; the
+            // handler's dedupe absorbs them.
+            if (amqp_basic_nack(connection_, channel_, delivery_tag, 0, 1) != AMQP_STATUS_OK) {
+                throw std::runtime_error("Failed to nack message");
+            }
+            backoff = std::min(max_backoff, std::max(min_backoff, backoff * 2));
+            std::cerr << "Message on " << queue << " requeued, pausing " << backoff.count()
+                      << " ms: " << error << std::endl;
+
+            auto wake_at = std::chrono::steady_clock::now() + backoff;
+            while (running.load() && std::chrono::steady_clock::now() < wake_at) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
             continue;
         }
 
@@ -1,42 +1,73 @@
 #include "payment_service.hpp"
 #include <stdexcept>
+#include <vector>
 
-PaymentService::PaymentService(std::shared_ptr<Database> db) : db_(std::move(db)) {}
+PaymentService::PaymentService(std::shared_ptr<ShardRouter> shards) : shards_(std::move(shards)) {}
 
+// The snapshot row plus the ledger entries it does not include yet; the covering index on
+// (user_id, txid) keeps the sum to an index-only scan of the recent entries.
+static const char* current_account_sql =
+    "SELECT a.user_id, a.balance + COALESCE(l.total, 0) AS balance, a.version + l.entries AS version "
+    "FROM accounts a CROSS JOIN balance_snapshot s "
+    "CROSS JOIN LATERAL (SELECT sum(amount) AS total, count(*) AS entries FROM ledger_entries "
+    "                    WHERE user_id = a.user_id AND txid >= s.horizon) l "
+    "WHERE a.user_id = $1";
+
+static models::Account account_from_row(const pqxx::row& row) {
+    models::Account account;
+    account.user_id = row["user_id"].as<std::string>();
+    account.balance = row["balance"].as<double>();
+    account.version = row["version"].as<int>();
+    return account;
+}
+
+static models::Account account_from_result(const QueryPipeline::Result& result) {
+    models::Account account;
+    account.user_id = result.value(0, "user_id").value();
+    account.balance = std::stod(result.value(0, "balance").value());
+    account.version = std::stoi(result.value(0, "version").value());
+    return account;
+}
+
+// Runs the batch and throws the first statement error, if any.
+static std::vector<QueryPipeline::Result> run_checked(Database& db, const QueryPipeline::Batch& batch) {
+    auto results = db.pipeline().run(batch);
+    for (const auto& result : results) {
+        if (!result.ok()) throw std::runtime_error(result.error);
+    }
+    return results;
+}
+
+// The insert and the read-back go out as one pipelined transaction: one round trip.
 models::Account PaymentService::create_account(const std::string& user_id) {
-    auto existing = db_->query(
-        "SELECT user_id FROM accounts WHERE user_id = $1",
+    auto& db = shards_->for_user(user_id);
+
+    QueryPipeline::Batch batch(true);
+    auto inserted = batch.add(
+        "INSERT INTO accounts (user_id, balance, version) VALUES ($1, 0, 0) "
+        "ON CONFLICT (user_id) DO NOTHING RETURNING user_id",
         user_id
     );
+    auto current = batch.add(current_account_sql, user_id);
+    auto results = run_checked(db, batch);
 
-    if (!existing.empty()) {
+    if (results[inserted].rows.empty()) {
         throw std::runtime_error("Account already exists");
     }
 
-    db_->execute(
-        "INSERT INTO accounts (user_id, balance, version) VALUES ($1, 0, 0)",
-        user_id
-    );
-
-    return get_account(user_id);
+    return account_from_result(results[current]);
 }
 
 models::Account PaymentService::get_account(const std::string& user_id) {
-    auto result = db_->query(
-        "SELECT user_id, balance, version FROM accounts WHERE user_id = $1",
-        user_id
-    );
+    auto& db = shards_->for_user(user_id);
+
+    auto result = db.query(current_account_sql, user_id);
 
     if (result.empty()) {
         throw std::runtime_error("Account not found");
     }
 
-    const auto& row = result[0];
-    models::Account account;
-    account.user_id = row["user_id"].as<std::string>();
-    account.balance = row["balance"].as<double>();
-    account.version = row["version"].as<int>();
-    return account;
+    return account_from_row(result[0]);
 }
 
 models::Account PaymentService::deposit(const std::string& user_id, double amount) {
@@ -44,63 +75,35 @@ models::Account PaymentService::deposit(const std::string& user_id, double amoun
         throw std::runtime_error("Amount must be positive");
     }
 
-    auto& tx = db_->begin_transaction();
+    auto& db = shards_->for_user(user_id);
 
-    auto result = db_->query(tx,
-        "UPDATE accounts SET balance = balance + $1, version = version + 1 "
-        "WHERE user_id = $2 "
-        "RETURNING user_id, balance, version",
+    // Deposits only append, so they never wait on the account row or on a debit. The entry
+    // and the read-back share one pipelined transaction; without an account nothing is written.
+    QueryPipeline::Batch batch(true);
+    auto inserted = batch.add(
+        "INSERT INTO ledger_entries (user_id, amount, kind) "
+        "SELECT user_id, $1::numeric, 'DEPOSIT' FROM accounts WHERE user_id = $2 "
+        "RETURNING id",
         amount, user_id
     );
+    auto current = batch.add(current_account_sql, user_id);
+    auto results = run_checked(db, batch);
 
-    if (result.empty()) {
-        tx.abort();
-        db_->rollback();
+    if (results[inserted].rows.empty()) {
         throw std::runtime_error("Account not found");
     }
 
-    tx.commit();
-    db_->commit();
-
-    const auto& row = result[0];
-    models::Account account;
-    account.user_id = row["user_id"].as<std::string>();
-    account.balance = row["balance"].as<double>();
-    account.version = row["version"].as<int>();
-    return account;
+    return account_from_result(results[current]);
 }
 
-bool PaymentService::process_payment(const std::string& user_id,
-                                     const std::string&,
-                                     double amount) {
-    if (amount <= 0) return false;
-
-    try {
-        auto account = get_account(user_id);
-
-        auto& tx = db_->begin_transaction();
-
-        auto result = db_->query(tx,
-            "UPDATE accounts SET balance = balance - $1, version = version + 1 "
-            "WHERE user_id = $2 AND balance >= $3 AND version = $4 "
-            "RETURNING user_id, balance, version",
-            amount, user_id, amount, account.version
-        );
-
-        if (result.empty()) {
-            tx.abort();
-            db_->rollback();
-            return false;
-        }
-
-        tx.commit();
-        db_->commit();
-        return true;
-    } catch (...) {
-        return false;
+double PaymentService::get_balance(const std::string& user_id) {
+    auto& db = shards_->for_user(user_id);
+
+    auto result = db.query_read(current_account_sql, user_id);
+
+    if (result.empty()) {
+        throw std::runtime_error("Account not found");
     }
-}
 
-double PaymentService::get_balance(const std::string& user_id) {
-    return get_account(user_id).balance;
+    return result[0]["balance"].as<double>();
 }
@@ -0,0 +1,348 @@
+// Moves accounts between payment shards after a change to the shard map.
+//
+//   payments-rebalance <old-map.json> <new-map.json> [--dry-run]
+//
+// Both maps must use the same bucket count; only bucket ownership may change. Run it with
+// payments-service stopped and payment.requests drained: accounts are copied to their new
+// shard and committed there before they are deleted from the old one, so a crash part-way
+// leaves duplicates (rerun to finish) but never loses a balance.
+//
+// Inbox rows follow the user named in their payment request. Processed rows are what stops a
+// republished request from being charged twice, and RETRY rows are only picked up by the
+// shard that owns the account, so both must live where the account does. PENDING outbox rows
+// follow the user named in their payment result, so a shard dropped from the map leaves
+// nothing unpublished behind; one whose result cannot be read keeps the shard from being
+// dropped. Each target receives its accounts, inbox and outbox rows in one transaction.
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include "database.hpp"
+#include "event_codec.hpp"
+#include "models.hpp"
+#include "shard_map.hpp"
+
+struct AccountRow {
+    std::string user_id;
+    std::string balance;
+    int version;
+    std::string created_at;
+    std::string updated_at;
+};
+
+static std::vector<AccountRow> accounts_to_move(Database& source, const ShardMap& to, std::size_t shard,
+                                                std::map<std::size_t, std::vector<AccountRow>>& by_target) {
+    std::vector<AccountRow> moved;
+    // The moved balance includes ledger entries newer than the source's snapshot horizon.
+    auto result = source.query(
+        "SELECT a.user_id, (a.balance + COALESCE(l.total, 0))::text AS balance, "
+        "       a.version + l.entries AS version, "
+        "       a.created_at::text AS created_at, a.updated_at::text AS updated_at "
+        "FROM accounts a CROSS JOIN balance_snapshot s "
+        "CROSS JOIN LATERAL (SELECT sum(amount) AS total, count(*) AS entries FROM ledger_entries "
+        "                    WHERE user_id = a.user_id AND txid >= s.horizon) l"
+    );
+    for (const auto& row : result) {
+        auto user_id = row["user_id"].as<std::string>();
+        auto target = to.shard_of(user_id);
+        if (target == shard) continue;
+
+        AccountRow account{
+            user_id,
+            row["balance"].as<std::string>(),
+            row["version"].as<int>(),
+            row["created_at"].as<std::string>(),
+            row["updated_at"].as<std::string>()
+        };
+        by_target[target].push_back(account);
+        moved.push_back(std::move(account));
+    }
+    return moved;
+}
+
+struct InboxRow {
+    std::string id;
+    std::string type;
+    std::string payload;
+    std::string status;
+    std::string processed_at;
+    int retry_count;
+    std::string content_type;
+    std::string next_attempt_at;
+    std::string last_error;
+    // Partition holding processed_at: day, the day after, and the name suffix.
+    std::string day;
+    std::string next_day;
+    std::string suffix;
+};
+
+static std::vector<InboxRow> inbox_to_move(Database& source, const ShardMap& to, std::size_t shard,
+                                           std::map<std::size_t, std::vector<InboxRow>>& by_target) {
+    std::vector<InboxRow> moved;
+    auto result = source.query(
+        "SELECT id, type, payload, status, processed_at::text AS processed_at, retry_count, content_type, "
+        "       COALESCE(next_attempt_at::text, '') AS next_attempt_at, COALESCE(last_error, '') AS last_error, "
+        "       processed_at::date::text AS day, (processed_at::date + 1)::text AS next_day, "
+        "       to_char(processed_at, 'YYYYMMDD') AS suffix "
+        "FROM inbox_events"
+    );
+    for (const auto& row : result) {
+        auto payload = pqxx::binarystring(row["payload"]).str();
+        auto content_type = row["content_type"].as<std::string>();
+
+        // A payload that cannot be read was never tied to an account; it stays where it is.
+        std::string user_id;
+        try {
+            auto request = models::messages::PaymentRequest::from_json(event_codec::decode(payload, content_type));
+            user_id = request.user_id;
+        } catch (const std::exception&) {
+            continue;
+        }
+
+        auto target = to.shard_of(user_id);
+        if (target == shard) continue;
+
+        InboxRow inbox{
+            row["id"].as<std::string>(),
+            row["type"].as<std::string>(),
+            std::move(payload),
+            row["status"].as<std::string>(),
+            row["processed_at"].as<std::string>(),
+            row["retry_count"].as<int>(),
+            std::move(content_type),
+            row["next_attempt_at"].as<std::string>(),
+            row["last_error"].as<std::string>(),
+            row["day"].as<std::string>(),
+            row["next_day"].as<std::string>(),
+            row["suffix"].as<std::string>()
+        };
+        by_target[target].push_back(inbox);
+        moved.push_back(std::move(inbox));
+    }
+    return moved;
+}
+
+struct OutboxRow {
+    std::string id;
+    std::string type;
+    std::string payload;
+    std::string created_at;
+    std::string aggregate_id;
+    std::string content_type;
+    // Partition holding created_at, as for InboxRow.
+    std::string day;
+    std::string next_day;
+    std::string suffix;
+};
+
+// Only PENDING rows move; processed ones are history the source keeps until retention drops them.
+static std::vector<OutboxRow> outbox_to_move(Database& source, const ShardMap& to, std::size_t shard,
+                                             std::map<std::size_t, std::vector<OutboxRow>>& by_target) {
+    std::vector<OutboxRow> moved;
+    auto result = source.query(
+        "SELECT id, type, payload, created_at::text AS created_at, COALESCE(aggregate_id, '') AS aggregate_id, "
+        "       content_type, created_at::date::text AS day, (created_at::date + 1)::text AS next_day, "
+        "       to_char(created_at, 'YYYYMMDD') AS suffix "
+        "FROM outbox_events WHERE status = 'PENDING'"
+    );
+    for (const auto& row : result) {
+        auto payload = pqxx::binarystring(row["payload"]).str();
+        auto content_type = row["content_type"].as<std::string>();
+
+        std::string user_id;
+        try {
+            auto payment_result = models::messages::PaymentResult::from_json(event_codec::decode(payload, content_type));
+            user_id = payment_result.user_id;
+        } catch (const std::exception&) {
+            if (shard != std::size_t(-1)) continue;
+            throw std::runtime_error("Cannot drop a shard with unreadable PENDING outbox event " +
+                                     row["id"].as<std::string>() + "; publish or remove it first");
+        }
+
+        auto target = to.shard_of(user_id);
+        if (target == shard) continue;
+
+        OutboxRow outbox{
+            row["id"].as<std::string>(),
+            row["type"].as<std::string>(),
+            std::move(payload),
+            row["created_at"].as<std::string>(),
+            row["aggregate_id"].as<std::string>(),
+            std::move(content_type),
+            row["day"].as<std::string>(),
+            row["next_day"].as<std::string>(),
+            row["suffix"].as<std::string>()
+        };
+        by_target[target].push_back(outbox);
+        moved.push_back(std::move(outbox));
+    }
+    return moved;
+}
+
+// The target only has daily partitions from today on, so an older row needs its day created; an
+// overlap means a partition migrated from a plain table already covers it. The names and bounds
+// are dates formatted by the source server.
+static void ensure_day_partition(Database& target, pqxx::transaction_base& tx, const std::string& table,
+                                 const std::string& suffix, const std::string& day, const std::string& next_day) {
+    target.execute(tx,
+        "DO $$ BEGIN "
+        "   CREATE TABLE IF NOT EXISTS " + table + "_p" + suffix +
+        "       PARTITION OF " + table + " FOR VALUES FROM ('" + day + "') TO ('" + next_day + "'); "
+        "EXCEPTION WHEN invalid_object_definition THEN NULL; "
+        "END $$");
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <old-map.json> <new-map.json> [--dry-run]" << std::endl;
+        return 2;
+    }
+    bool dry_run = argc > 3 && std::strcmp(argv[3], "--dry-run") == 0;
+
+    try {
+        auto from = ShardMap::from_file(argv[1]);
+        auto to = ShardMap::from_file(argv[2]);
+        if (from.bucket_count() != to.bucket_count()) {
+            throw std::runtime_error("Shard maps must use the same bucket count");
+        }
+
+        std::vector<std::shared_ptr<Database>> targets;
+        for (std::size_t i = 0; i < to.shards().size(); ++i) {
+            targets.push_back(to.connect(i));
+            if (!dry_run) targets.back()->initialize_schema();
+        }
+
+        std::size_t total = 0;
+        for (std::size_t i = 0; i < from.shards().size(); ++i) {
+            auto source = from.connect(i);
+
+            // Shards are matched by database, not position; a database missing from the new
+            // map gives all of its accounts away.
+            auto self = std::size_t(-1);
+            for (std::size_t j = 0; j < to.shards().size(); ++j) {
+                const auto& a = from.shards()[i];
+                const auto& b = to.shards()[j];
+                if (a.host == b.host && a.port == b.port && a.dbname == b.dbname) self = j;
+            }
+
+            std::map<std::size_t, std::vector<AccountRow>> by_target;
+            auto moved = accounts_to_move(*source, to, self, by_target);
+            std::map<std::size_t, std::vector<InboxRow>> inbox_by_target;
+            auto moved_inbox = inbox_to_move(*source, to, self, inbox_by_target);
+            std::map<std::size_t, std::vector<OutboxRow>> outbox_by_target;
+            auto moved_outbox = outbox_to_move(*source, to, self, outbox_by_target);
+            std::cout << from.shards()[i].name << ": " << moved.size() << " accounts, "
+                      << moved_inbox.size() << " inbox events, "
+                      << moved_outbox.size() << " pending outbox events to move" << std::endl;
+            total += moved.size();
+            if (dry_run || (moved.empty() && moved_inbox.empty() && moved_outbox.empty())) continue;
+
+            std::set<std::size_t> touched;
+            for (const auto& entry : by_target) touched.insert(entry.first);
+            for (const auto& entry : inbox_by_target) touched.insert(entry.first);
+            for (const auto& entry : outbox_by_target) touched.insert(entry.first);
+
+            for (auto target : touched) {
+                auto& tx = targets[target]->begin_transaction();
+                const auto& accounts = by_target[target];
+                const auto& events = inbox_by_target[target];
+                const auto& outbox = outbox_by_target[target];
+
+                for (const auto& account : accounts) {
+                    targets[target]->execute(tx,
+                        "INSERT INTO accounts (user_id, balance, version, created_at, updated_at) "
+                        "VALUES ($1, $2::numeric, $3, $4::timestamp, $5::timestamp) "
+                        "ON CONFLICT (user_id) DO UPDATE SET balance = EXCLUDED.balance, "
+                        "version = EXCLUDED.version, updated_at = EXCLUDED.updated_at",
+                        account.user_id, account.balance, account.version,
+                        account.created_at, account.updated_at
+                    );
+
+                    // The history moves along as an audit trail. txid 0 is below every horizon,
+                    // so the target treats these entries as already part of the balance. A rerun
+                    // replaces what an interrupted run copied.
+                    targets[target]->execute(tx,
+                        "DELETE FROM ledger_entries WHERE user_id = $1 AND txid = 0", account.user_id);
+                    auto entries = source->query(
+                        "SELECT amount::text AS amount, kind, COALESCE(reference, '') AS reference, "
+                        "       created_at::text AS created_at "
+                        "FROM ledger_entries WHERE user_id = $1 ORDER BY id",
+                        account.user_id
+                    );
+                    for (const auto& entry : entries) {
+                        targets[target]->execute(tx,
+                            "INSERT INTO ledger_entries (user_id, amount, kind, reference, txid, created_at) "
+                            "VALUES ($1, $2::numeric, $3, NULLIF($4, ''), 0, $5::timestamp)",
+                            account.user_id,
+                            entry["amount"].as<std::string>(),
+                            entry["kind"].as<std::string>(),
+                            entry["reference"].as<std::string>(),
+                            entry["created_at"].as<std::string>()
+                        );
+                    }
+                }
+
+                std::set<std::string> days;
+                for (const auto& event : events) {
+                    if (days.insert(event.suffix).second) {
+                        ensure_day_partition(*targets[target], tx, "inbox_events", event.suffix, event.day, event.next_day);
+                    }
+                    targets[target]->execute(tx,
+                        "INSERT INTO inbox_events (id, type, payload, status, processed_at, retry_count, "
+                        "                          content_type, next_attempt_at, last_error) "
+                        "VALUES ($1, $2, $3, $4, $5::timestamp, $6, $7, NULLIF($8, '')::timestamp, NULLIF($9, '')) "
+                        "ON CONFLICT DO NOTHING",
+                        event.id, event.type, pqxx::binarystring(event.payload), event.status,
+                        event.processed_at, event.retry_count, event.content_type,
+                        event.next_attempt_at, event.last_error
+                    );
+                }
+
+                days.clear();
+                for (const auto& event : outbox) {
+                    if (days.insert(event.suffix).second) {
+                        ensure_day_partition(*targets[target], tx, "outbox_events", event.suffix, event.day, event.next_day);
+                    }
+                    // Claims belong to the source's processors, so the row arrives unclaimed.
+                    targets[target]->execute(tx,
+                        "INSERT INTO outbox_events (id, type, payload, status, created_at, aggregate_id, content_type) "
+                        "VALUES ($1, $2, $3, 'PENDING', $4::timestamp, NULLIF($5, ''), $6) "
+                        "ON CONFLICT DO NOTHING",
+                        event.id, event.type, pqxx::binarystring(event.payload), event.created_at,
+                        event.aggregate_id, event.content_type
+                    );
+                }
+
+                targets[target]->commit();
+                std::cout << "  " << accounts.size() << " accounts, " << events.size() << " inbox events, "
+                          << outbox.size() << " pending outbox events -> " << to.shards()[target].name << std::endl;
+            }
+
+            auto& tx = source->begin_transaction();
+            for (const auto& account : moved) {
+                source->execute(tx, "DELETE FROM ledger_entries WHERE user_id = $1", account.user_id);
+                source->execute(tx, "DELETE FROM accounts WHERE user_id = $1", account.user_id);
+            }
+            for (const auto& event : moved_inbox) {
+                source->execute(tx, "DELETE FROM inbox_events WHERE id = $1 AND processed_at = $2::timestamp",
+                                event.id, event.processed_at);
+            }
+            for (const auto& event : moved_outbox) {
+                source->execute(tx, "DELETE FROM outbox_events WHERE id = $1 AND created_at = $2::timestamp "
+                                    "AND status = 'PENDING'",
+                                event.id, event.created_at);
+            }
+            source->commit();
+        }
+
+        std::cout << (dry_run ? "Would move " : "Moved ") << total << " accounts" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Rebalance failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,157 @@
+#include "retry_scheduler.hpp"
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
+RetryScheduler::RetryScheduler(std::shared_ptr<ShardRouter> shards, const MessageQueueConfig& mq_config,
+                               RetryConfig config, Redrive redrive)
+    : shards_(std::move(shards)), config_(std::move(config)), redrive_(std::move(redrive)),
+      wheel_(config_.tick, config_.wheel_slots) {
+    message_queue_ = std::make_unique<MessageQueue>(mq_config);
+}
+
+void RetryScheduler::schedule(std::size_t shard, const std::string& event_id, std::chrono::milliseconds delay) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!armed_.emplace(shard, event_id).second) return;
+    wheel_.schedule(Due{shard, event_id}, TimerWheel<Due>::Clock::now() + delay);
+}
+
+std::chrono::milliseconds RetryScheduler::delay_for(int retry_count) const {
+    auto delay = config_.base_delay;
+    for (int i = 0; i < retry_count && delay < config_.max_delay; ++i) {
+        delay *= 2;
+    }
+    return std::min(delay, config_.max_delay);
+}
+
+void RetryScheduler::run(const std::atomic_bool& running) {
+    try {
+        load_pending();
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to load pending inbox retries: " << e.what() << std::endl;
+    }
+    auto next_rescan = std::chrono::steady_clock::now() + config_.rescan_interval;
+
+    while (running.load()) {
+        std::this_thread::sleep_for(config_.tick);
+
+        if (std::chrono::steady_clock::now() >= next_rescan) {
+            try {
+                rescan_overdue();
+            } catch (const std::exception& e) {
+                std::cerr << "Failed to rescan overdue inbox retries: " << e.what() << std::endl;
+            }
+            next_rescan = std::chrono::steady_clock::now() + config_.rescan_interval;
+        }
+
+        std::vector<Due> due;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            due = wheel_.advance(TimerWheel<Due>::Clock::now());
+            for (const auto& item : due) {
+                armed_.erase({item.shard, item.event_id});
+            }
+        }
+
+        for (const auto& item : due) {
+            try {
+                attempt(item);
+            } catch (const std::exception& e) {
+                // The row is untouched; try again after the first backoff step.
+                std::cerr << "Inbox retry of " << item.event_id << " failed: " << e.what() << std::endl;
+                schedule(item.shard, item.event_id, delay_for(0));
+            }
+        }
+    }
+}
+
+void RetryScheduler::load_pending() {
+    for (std::size_t i = 0; i < shards_->size(); ++i) {
+        auto rows = shards_->shard(i).query(
+            "SELECT id, GREATEST(0, EXTRACT(EPOCH FROM next_attempt_at - localtimestamp) * 1000)::bigint AS delay_ms "
+            "FROM inbox_events WHERE status = 'RETRY'"
+        );
+        for (const auto& row : rows) {
+            schedule(i, row["id"].as<std::string>(), std::chrono::milliseconds(row["delay_ms"].as<long long>()));
+        }
+        if (!rows.empty()) {
+            std::cout << "Scheduled " << rows.size() << " pending inbox retries on shard " << i << std::endl;
+        }
+    }
+}
+
+// Rows armed here fire within a tick of next_attempt_at, so a row overdue by a whole rescan
+// interval and not armed here is most likely orphaned. Should its owner still be alive, the
+// retry_count guard in attempt() lets only one of the two attempts count.
+void RetryScheduler::rescan_overdue() {
+    for (std::size_t i = 0; i < shards_->size(); ++i) {
+        auto rows = shards_->shard(i).query(
+            "SELECT id FROM inbox_events WHERE status = 'RETRY' "
+            "AND next_attempt_at <= localtimestamp - $1 * interval '1 millisecond'",
+            static_cast<long long>(config_.rescan_interval.count())
+        );
+
+        std::size_t adopted = 0;
+        for (const auto& row : rows) {
+            auto event_id = row["id"].as<std::string>();
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (armed_.count({i, event_id})) continue;
+            }
+            schedule(i, event_id, std::chrono::milliseconds(0));
+            ++adopted;
+        }
+        if (adopted > 0) {
+            std::cout << "Adopted " << adopted << " overdue inbox retries on shard " << i << std::endl;
+        }
+    }
+}
+
+void RetryScheduler::attempt(const Due& due) {
+    auto& db = shards_->shard(due.shard);
+    auto rows = db.query(
+        "SELECT payload, content_type, retry_count FROM inbox_events WHERE id = $1 AND status = 'RETRY'",
+        due.event_id
+    );
+    // Already processed, e.g. by a redelivery, or dead-lettered by another replica.
+    if (rows.empty()) return;
+
+    auto payload = pqxx::binarystring(rows[0]["payload"]).str();
+    auto content_type = rows[0]["content_type"].as<std::string>();
+    auto retry_count = rows[0]["retry_count"].as<int>();
+
+    std::string error;
+    try {
+        redrive_(*shards_, payload, content_type);
+        return;
+    } catch (const std::exception& e) {
+        error = e.what();
+    }
+
+    auto retries = retry_count + 1;
+    if (retries >= config_.max_retries) {
+        // Matching on retry_count lets only one replica count (and dead-letter) this attempt.
+        auto marked = db.query(
+            "UPDATE inbox_events SET status = 'DEAD', retry_count = $2, last_error = $3, next_attempt_at = NULL "
+            "WHERE id = $1 AND status = 'RETRY' AND retry_count = $4 RETURNING id",
+            due.event_id, retries, error, retry_count
+        );
+        if (marked.empty()) return;
+
+        message_queue_->publish(config_.dead_letter_queue, payload, content_type);
+        std::cerr << "Inbox event " << due.event_id << " dead-lettered after " << retries
+                  << " retries: " << error << std::endl;
+        return;
+    }
+
+    auto delay = delay_for(retries);
+    auto updated = db.query(
+        "UPDATE inbox_events SET retry_count = $2, last_error = $3, "
+        "next_attempt_at = localtimestamp + $4 * interval '1 millisecond' "
+        "WHERE id = $1 AND status = 'RETRY' AND retry_count = $5 RETURNING id",
+        due.event_id, retries, error, static_cast<long long>(delay.count()), retry_count
+    );
+    if (updated.empty()) return;
+
+    schedule(due.shard, due.event_id, delay);
+}
@@ -0,0 +1,103 @@
+#include "shard_map.hpp"
+#include <fstream>
+#include <stdexcept>
+#include <nlohmann/json.hpp>
+#include "utils.hpp"
+
+using json = nlohmann::json;
+
+static constexpr std::size_t unowned = static_cast<std::size_t>(-1);
+
+ShardMap::ShardMap(std::vector<ShardConfig> shards, std::vector<std::size_t> bucket_owner)
+    : shards_(std::move(shards)), bucket_owner_(std::move(bucket_owner)) {
+    if (shards_.empty()) {
+        throw std::runtime_error("Shard map has no shards");
+    }
+    if (bucket_owner_.empty()) {
+        throw std::runtime_error("Shard map has no buckets");
+    }
+    for (std::size_t bucket = 0; bucket < bucket_owner_.size(); ++bucket) {
+        if (bucket_owner_[bucket] >= shards_.size()) {
+            throw std::runtime_error("Shard map leaves bucket " + std::to_string(bucket) + " unassigned");
+        }
+    }
+}
+
+ShardMap ShardMap::from_file(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("Cannot open shard map " + path);
+    }
+    auto j = json::parse(in);
+
+    auto bucket_count = j.value("buckets", std::size_t{1024});
+    std::vector<ShardConfig> shards;
+    std::vector<std::size_t> owner(bucket_count, unowned);
+    bool explicit_buckets = false;
+
+    for (const auto& entry : j.at("shards")) {
+        ShardConfig shard;
+        shard.name = entry.value("name", "shard-" + std::to_string(shards.size()));
+        shard.host = entry.at("host").get<std::string>();
+        shard.port = entry.value("port", std::string{"5432"});
+        shard.dbname = entry.value("dbname", std::string{"payments_db"});
+        shard.user = entry.at("user").get<std::string>();
+        shard.password = entry.at("password").get<std::string>();
+        shard.replica_host = entry.value("replica_host", std::string{});
+
+        for (const auto& range : entry.value("buckets", json::array())) {
+            explicit_buckets = true;
+            auto first = range.at(0).get<std::size_t>();
+            auto last = range.at(1).get<std::size_t>();
+            if (first > last || last >= bucket_count) {
+                throw std::runtime_error("Invalid bucket range for shard " + shard.name);
+            }
+            for (auto bucket = first; bucket <= last; ++bucket) {
+                if (owner[bucket] != unowned) {
+                    throw std::runtime_error("Bucket " + std::to_string(bucket) + " is assigned twice");
+                }
+                owner[bucket] = shards.size();
+            }
+        }
+
+        shards.push_back(std::move(shard));
+    }
+
+    if (!explicit_buckets) {
+        for (std::size_t bucket = 0; bucket < bucket_count; ++bucket) {
+            owner[bucket] = bucket * shards.size() / bucket_count;
+        }
+    }
+
+    return ShardMap(std::move(shards), std::move(owner));
+}
+
+ShardMap ShardMap::single(ShardConfig shard) {
+    std::vector<ShardConfig> shards;
+    shards.push_back(std::move(shard));
+    return ShardMap(std::move(shards), std::vector<std::size_t>(1, 0));
+}
+
+std::size_t ShardMap::bucket_of(const std::string& user_id) const {
+    return utils::stable_hash(user_id) % bucket_owner_.size();
+}
+
+std::size_t ShardMap::shard_of(const std::string& user_id) const {
+    return bucket_owner_[bucket_of(user_id)];
+}
+
+std::size_t ShardMap::shard_of_bucket(std::size_t bucket) const {
+    return bucket_owner_.at(bucket);
+}
+
+std::shared_ptr<Database> ShardMap::connect(std::size_t shard) const {
+    const auto& config = shards_.at(shard);
+    return std::make_shared<Database>(config.host, config.port, config.dbname, config.user, config.password);
+}
+
+ShardRouter::ShardRouter(const ShardMap& map, std::vector<std::shared_ptr<Database>> databases)
+    : map_(map), databases_(std::move(databases)) {
+    if (databases_.size() != map_.shards().size()) {
+        throw std::runtime_error("Shard router needs one database per shard");
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef AMQP_CONSUMER_HPP
+#define AMQP_CONSUMER_HPP
+
+#include <boost/asio.hpp>
+#include <functional>
+#include <memory>
+#include <string>
+#include "message_queue.hpp"
+
+namespace asio = boost::asio;
+
+// Drives a MessageQueue from the io_context: waits for its socket to become readable,
+// then drains deliveries on the same executor that runs the WebSocket sessions.
+class AmqpConsumer : public std::enable_shared_from_this<AmqpConsumer> {
+public:
+    using MessageHandler = MessageQueue::MessageHandler;
+    using ErrorHandler = std::function<void(const std::exception&)>;
+
+    AmqpConsumer(asio::io_context& ioc, MessageQueue& message_queue,
+                 MessageHandler on_message, ErrorHandler on_error);
+    ~AmqpConsumer();
+
+    // The queue must already be consuming (see MessageQueue::start_consuming*).
+    void start();
+
+private:
+    void do_wait();
+    void on_readable(const boost::system::error_code& ec);
+
+    MessageQueue& message_queue_;
+    asio::posix::stream_descriptor descriptor_;
+    MessageHandler on_message_;
+    ErrorHandler on_error_;
+};
+
+#endif
@@ -3,7 +3,7 @@
 
 #include <string>
 #include <functional>
-#include <atomic>
+#include <vector>
 #include <amqp.h>
 
 struct MessageQueueConfig {
@@ -19,11 +19,28 @@ public:
     ~MessageQueue();
 
     void publish(const std::string& queue, const std::string& message);
-    void consume(const std::string& queue,
-                 std::function<void(const std::string&)> callback,
-                 std::atomic_bool& running);
+
+    // Declares the queue and registers the consumer; deliveries are then pulled with drain().
+    void start_consuming(const std::string& queue);
+
+    // Declares a durable topic exchange and an exclusive, auto-delete queue private to this
+    // connection, binds it with each key and registers the consumer. Returns the queue name.
+    std::string start_consuming_exchange(const std::string& exchange,
+                                         const std::vector<std::string>& binding_keys);
+
+    // Handler receives one event and its AMQP content type (empty when the publisher set none);
+    // a batch envelope calls it once per event.
+    using MessageHandler = std::function<void(const std::string&, const std::string&)>;
+
+    // Hands every delivery that is already buffered or readable to callback without blocking.
+    void drain(const MessageHandler& callback);
+
+    // Socket owned by rabbitmq-c, exposed so the caller can wait for readability.
+    int socket_fd() const;
 
 private:
+    void basic_consume(amqp_bytes_t queue);
+
     amqp_connection_state_t connection_{};
     amqp_channel_t channel_{1};
 };
@@ -3,25 +3,68 @@
 
 #include <string>
 #include <unordered_map>
-#include <set>
+#include <vector>
 #include <mutex>
 #include <memory>
+#include <cstddef>
+#include <cstdint>
 #include <nlohmann/json.hpp>
+#include "order_state_cache.hpp"
 
 class WebSocketSession;
 
 class NotificationManager {
 public:
+    // shard_count is rounded up to a power of two so a shard is picked with a mask.
+    explicit NotificationManager(OrderStateCache& state_cache, std::size_t shard_count = 16);
+
     void subscribe(const std::string& order_id, const std::shared_ptr<WebSocketSession>& session);
     void unsubscribe(const std::string& order_id, const std::shared_ptr<WebSocketSession>& session);
-    void notify(const std::string& order_id, const nlohmann::json& message);
+
+    void subscribe_user(const std::string& user_id, const std::shared_ptr<WebSocketSession>& session);
+    void unsubscribe_user(const std::string& user_id, const std::shared_ptr<WebSocketSession>& session);
+
+    // Stamps the update with a sequence number and the cache epoch and records it as the order's last state before
+    // delivering to everyone watching the order or its owner; a session subscribed both ways gets one copy.
+    void notify(const std::string& order_id, const std::string& user_id, nlohmann::json message);
+
+    // Last recorded update for the order if it is newer than since_seq; subscribe first, then call
+    // this, so an update racing with the subscription is delivered at least once. since_seq only
+    // counts when epoch matches this instance's; a seq from a restarted or different instance
+    // would otherwise hide a newer update.
+    SharedMessage last_state(const std::string& order_id, std::uint64_t since_seq = 0, std::uint64_t epoch = 0);
 
 private:
     using WeakSession = std::weak_ptr<WebSocketSession>;
-    using WeakSet = std::set<WeakSession, std::owner_less<WeakSession>>;
+    using WeakList = std::vector<WeakSession>;
+
+    class Registry {
+    public:
+        explicit Registry(std::size_t shard_count);
+
+        void add(const std::string& key, const std::shared_ptr<WebSocketSession>& session);
+        void remove(const std::string& key, const std::shared_ptr<WebSocketSession>& session);
+        WeakList snapshot(const std::string& key);
+        void prune_expired(const std::string& key);
+
+    private:
+        struct Shard {
+            std::mutex mutex;
+            std::unordered_map<std::string, WeakList> subscriptions;
+        };
+
+        Shard& shard_for(const std::string& key);
+
+        std::vector<std::unique_ptr<Shard>> shards_;
+        std::size_t shard_mask_{0};
+    };
+
+    void collect(Registry& registry, const std::string& key,
+                 std::vector<std::shared_ptr<WebSocketSession>>& targets);
 
-    std::unordered_map<std::string, WeakSet> subscriptions_;
-    std::mutex mutex_;
+    OrderStateCache& state_cache_;
+    Registry orders_;
+    Registry users_;
 };
 
 #endif
@@ -0,0 +1,63 @@
+#ifndef ORDER_STATE_CACHE_HPP
+#define ORDER_STATE_CACHE_HPP
+
+#include <string>
+#include <unordered_map>
+#include <list>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include "websocket_server.hpp"
+
+// Bounded, TTL-based store of the last update sent for each order.
+// Sequence numbers come from one instance-wide counter, so they only grow per order,
+// even after an entry has been evicted and recreated. The counter restarts with the process
+// and differs between instances, so every seq is only meaningful next to this cache's epoch.
+class OrderStateCache {
+public:
+    OrderStateCache(std::size_t max_entries, std::chrono::seconds ttl, std::size_t shard_count = 16);
+
+    std::uint64_t next_sequence();
+
+    // Identifies this cache's sequence space; taken from the clock at construction.
+    std::uint64_t epoch() const { return epoch_; }
+
+    // Keeps message unless a newer sequence is already stored for the order.
+    void store(const std::string& order_id, std::uint64_t seq, SharedMessage message);
+
+    // Returns the cached update if it is newer than since_seq and has not expired.
+    SharedMessage lookup(const std::string& order_id, std::uint64_t since_seq = 0);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        SharedMessage message;
+        std::uint64_t seq{0};
+        Clock::time_point updated_at;
+        std::list<std::string>::iterator age_pos;
+    };
+
+    // age holds keys oldest-first, so expired and least recently updated entries sit at the front.
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, Entry> entries;
+        std::list<std::string> age;
+    };
+
+    Shard& shard_for(const std::string& order_id);
+    void evict_front(Shard& shard);
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::size_t shard_mask_{0};
+    std::size_t max_entries_per_shard_{1};
+    std::chrono::seconds ttl_;
+    std::uint64_t epoch_;
+    std::atomic<std::uint64_t> sequence_{0};
+};
+
+#endif
@@ -6,6 +6,10 @@
 #include <memory>
 #include <string>
 #include <deque>
+#include <unordered_set>
+#include <vector>
+#include <atomic>
+#include <cstdint>
 
 namespace asio = boost::asio;
 namespace beast = boost::beast;
@@ -14,35 +18,89 @@ using tcp = asio::ip::tcp;
 
 class NotificationManager;
 
+enum class SlowConsumerPolicy {
+    drop_oldest,
+    conflate,
+    close
+};
+
+struct WebSocketSessionOptions {
+    // Offer the permessage-deflate extension during the handshake.
+    bool permessage_deflate{false};
+    int deflate_level{6};
+    // Pack everything queued since the last write into one JSON-array frame.
+    // A lone queued message is still sent as-is, so clients must accept both shapes.
+    bool coalesce_writes{false};
+
+    // Per-session write queue caps; the policy decides what gives when either is exceeded. A
+    // message larger than max_queue_bytes on its own is rejected before the policy runs.
+    std::size_t max_queue_messages{1024};
+    std::size_t max_queue_bytes{1024 * 1024};
+    SlowConsumerPolicy slow_consumer_policy{SlowConsumerPolicy::drop_oldest};
+    std::uint16_t slow_consumer_close_code{static_cast<std::uint16_t>(websocket::close_code::policy_error)};
+};
+
+struct WebSocketMetrics {
+    std::atomic<std::uint64_t> dropped_messages{0};
+    std::atomic<std::uint64_t> evicted_sessions{0};
+    // Rejected for exceeding max_queue_bytes alone; counted once per session it was sent to.
+    std::atomic<std::uint64_t> oversized_messages{0};
+};
+
+// Immutable outbound frame; one instance is shared by every session it fans out to.
+struct OutboundMessage {
+    std::string payload;
+    // Messages sharing a non-empty key may replace each other under the conflate policy.
+    std::string conflation_key;
+};
+
+using SharedMessage = std::shared_ptr<const OutboundMessage>;
+
 class WebSocketSession : public std::enable_shared_from_this<WebSocketSession> {
 public:
-    WebSocketSession(tcp::socket socket, asio::io_context& ioc, NotificationManager& notification_manager);
+    WebSocketSession(tcp::socket socket, asio::io_context& ioc, NotificationManager& notification_manager,
+                     const WebSocketSessionOptions& options, WebSocketMetrics& metrics);
 
     void start();
+    void send(SharedMessage message);
     void send(std::string message);
 
 private:
     void on_accept(beast::error_code ec);
     void do_read();
     void on_read(beast::error_code ec, std::size_t bytes_transferred);
+    void release_subscriptions();
 
-    void enqueue_write(std::string message);
+    void enqueue_write(SharedMessage message);
+    bool queue_over_limit() const;
+    void apply_slow_consumer_policy();
+    void conflate_pending();
+    void drop_pending_at(std::size_t index);
+    void evict();
     void do_write();
     void on_write(beast::error_code ec, std::size_t bytes_transferred);
 
     websocket::stream<tcp::socket> ws_;
     asio::strand<asio::io_context::executor_type> strand_;
     NotificationManager& notification_manager_;
+    WebSocketSessionOptions options_;
+    WebSocketMetrics& metrics_;
     beast::flat_buffer buffer_;
-    std::string order_id_;
+    std::unordered_set<std::string> order_ids_;
+    std::unordered_set<std::string> user_ids_;
 
-    std::deque<std::string> write_queue_;
+    std::deque<SharedMessage> write_queue_;
+    std::size_t queued_bytes_{0};
+    std::vector<asio::const_buffer> write_buffers_;
+    std::size_t in_flight_{0};
     bool writing_{false};
+    bool closing_{false};
 };
 
 class WebSocketServer {
 public:
-    WebSocketServer(asio::io_context& ioc, NotificationManager& notification_manager);
+    WebSocketServer(asio::io_context& ioc, NotificationManager& notification_manager,
+                    WebSocketMetrics& metrics, const WebSocketSessionOptions& options = {});
     void run(const std::string& address, unsigned short port);
 
 private:
@@ -52,6 +110,8 @@ private:
     asio::io_context& ioc_;
     tcp::acceptor acceptor_;
     NotificationManager& notification_manager_;
+    WebSocketMetrics& metrics_;
+    WebSocketSessionOptions options_;
 };
 
 #endif
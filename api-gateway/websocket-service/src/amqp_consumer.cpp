@@ -0,0 +1,53 @@
+#include "amqp_consumer.hpp"
+#include <stdexcept>
+
+AmqpConsumer::AmqpConsumer(asio::io_context& ioc, MessageQueue& message_queue,
+                           MessageHandler on_message, ErrorHandler on_error)
+    : message_queue_(message_queue),
+      descriptor_(ioc),
+      on_message_(std::move(on_message)),
+      on_error_(std::move(on_error)) {
+}
+
+AmqpConsumer::~AmqpConsumer() {
+    // The fd belongs to rabbitmq-c; detach it so the descriptor does not close it.
+    if (descriptor_.is_open()) {
+        descriptor_.release();
+    }
+}
+
+void AmqpConsumer::start() {
+    int fd = message_queue_.socket_fd();
+    if (fd < 0) {
+        throw std::runtime_error("RabbitMQ socket is not open");
+    }
+    descriptor_.assign(fd);
+
+    // basic_consume may already have buffered deliveries that will never raise readability.
+    on_readable({});
+}
+
+void AmqpConsumer::do_wait() {
+    descriptor_.async_wait(
+        asio::posix::stream_descriptor::wait_read,
+        [self = shared_from_this()](const boost::system::error_code& ec) {
+            self->on_readable(ec);
+        }
+    );
+}
+
+void AmqpConsumer::on_readable(const boost::system::error_code& ec) {
+    if (ec == asio::error::operation_aborted) return;
+
+    try {
+        if (ec) {
+            throw boost::system::system_error(ec);
+        }
+        message_queue_.drain(on_message_);
+    } catch (const std::exception& e) {
+        on_error_(e);
+        return;
+    }
+
+    do_wait();
+}
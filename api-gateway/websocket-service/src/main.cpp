@@ -1,15 +1,21 @@
 #include <iostream>
 #include <memory>
-#include <thread>
-#include <atomic>
 #include <cstdlib>
 #include <ctime>
 #include <csignal>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <sstream>
+#include <vector>
 #include <boost/asio.hpp>
 #include <boost/asio/signal_set.hpp>
 #include <nlohmann/json.hpp>
+#include "amqp_consumer.hpp"
+#include "event_codec.hpp"
 #include "message_queue.hpp"
 #include "notification_manager.hpp"
+#include "order_state_cache.hpp"
 #include "websocket_server.hpp"
 
 namespace asio = boost::asio;
@@ -20,15 +26,32 @@ static const char* env_or(const char* key, const char* def_val) {
     return v ? v : def_val;
 }
 
+// WS_RESULT_SHARDS="3,7" binds only those order-hash shards; empty binds every shard.
+static std::vector<std::string> result_binding_keys(const std::string& shards) {
+    std::vector<std::string> keys;
+    std::stringstream ss(shards);
+    std::string shard;
+    while (std::getline(ss, shard, ',')) {
+        if (!shard.empty()) keys.push_back("order." + shard);
+    }
+    if (keys.empty()) keys.push_back("#");
+    return keys;
+}
+
+static SlowConsumerPolicy parse_slow_consumer_policy(const std::string& name) {
+    if (name == "drop_oldest") return SlowConsumerPolicy::drop_oldest;
+    if (name == "conflate") return SlowConsumerPolicy::conflate;
+    if (name == "close") return SlowConsumerPolicy::close;
+    throw std::runtime_error("Unknown WS_SLOW_CONSUMER_POLICY: " + name);
+}
+
 int main() {
     try {
         asio::io_context ioc;
 
         asio::signal_set signals(ioc, SIGINT, SIGTERM);
-        std::atomic_bool running{true};
 
         signals.async_wait([&](const boost::system::error_code&, int) {
-            running.store(false);
             ioc.stop();
         });
 
@@ -39,47 +62,76 @@ int main() {
             env_or("RABBITMQ_PASS", "password")
         };
 
-        NotificationManager notification_manager;
+        OrderStateCache state_cache(
+            std::stoul(env_or("WS_STATE_CACHE_MAX_ENTRIES", "100000")),
+            std::chrono::seconds(std::stoi(env_or("WS_STATE_CACHE_TTL", "300"))));
+        NotificationManager notification_manager(state_cache, std::stoul(env_or("WS_REGISTRY_SHARDS", "16")));
         MessageQueue message_queue(mq_config);
 
-        std::thread consumer([&]() {
-            try {
-                message_queue.consume("payment.results",
-                    [&](const std::string& message) {
-                        try {
-                            auto j = json::parse(message);
-                            auto order_id = j.at("order_id").get<std::string>();
-
-                            json notification = {
-                                {"type", "order_update"},
-                                {"order_id", order_id},
-                                {"status", j.value("success", false) ? "FINISHED" : "CANCELLED"},
-                                {"message", j.value("message", std::string{})},
-                                {"timestamp", std::time(nullptr)}
-                            };
-
-                            notification_manager.notify(order_id, notification);
-                        } catch (...) {
-                        }
-                    },
-                    running
-                );
-            } catch (const std::exception& e) {
+        auto consumer = std::make_shared<AmqpConsumer>(ioc, message_queue,
+            [&](const std::string& message, const std::string& content_type) {
+                try {
+                    auto j = event_codec::decode(message, content_type);
+                    auto order_id = j.at("order_id").get<std::string>();
+                    auto user_id = j.value("user_id", std::string{});
+
+                    json notification = {
+                        {"type", "order_update"},
+                        {"order_id", order_id},
+                        {"user_id", user_id},
+                        {"status", j.value("success", false) ? "FINISHED" : "CANCELLED"},
+                        {"message", j.value("message", std::string{})},
+                        {"timestamp", std::time(nullptr)}
+                    };
+
+                    notification_manager.notify(order_id, user_id, std::move(notification));
+                } catch (...) {
+                }
+            },
+            [&](const std::exception& e) {
                 std::cerr << "Consumer error: " << e.what() << std::endl;
-                running.store(false);
                 ioc.stop();
             }
-        });
+        );
+        message_queue.start_consuming_exchange(
+            env_or("PAYMENT_RESULTS_EXCHANGE", "payment.results"),
+            result_binding_keys(env_or("WS_RESULT_SHARDS", "")));
+        consumer->start();
+
+        WebSocketSessionOptions session_options;
+        session_options.permessage_deflate = std::string(env_or("WS_PERMESSAGE_DEFLATE", "0")) == "1";
+        session_options.deflate_level = std::stoi(env_or("WS_DEFLATE_LEVEL", "6"));
+        session_options.coalesce_writes = std::string(env_or("WS_COALESCE_WRITES", "0")) == "1";
+        session_options.max_queue_messages = std::stoul(env_or("WS_MAX_QUEUE_MESSAGES", "1024"));
+        session_options.max_queue_bytes = std::stoul(env_or("WS_MAX_QUEUE_BYTES", "1048576"));
+        session_options.slow_consumer_policy = parse_slow_consumer_policy(env_or("WS_SLOW_CONSUMER_POLICY", "drop_oldest"));
+        session_options.slow_consumer_close_code =
+            static_cast<std::uint16_t>(std::stoi(env_or("WS_SLOW_CONSUMER_CLOSE_CODE", "1008")));
+
+        WebSocketMetrics metrics;
 
-        auto server = std::make_shared<WebSocketServer>(ioc, notification_manager);
+        asio::steady_timer metrics_timer(ioc);
+        auto metrics_interval = std::chrono::seconds(std::stoi(env_or("WS_METRICS_INTERVAL", "60")));
+        std::function<void()> schedule_metrics = [&]() {
+            metrics_timer.expires_after(metrics_interval);
+            metrics_timer.async_wait([&](const boost::system::error_code& ec) {
+                if (ec) return;
+                std::cout << "ws metrics: dropped_messages=" << metrics.dropped_messages.load()
+                          << " evicted_sessions=" << metrics.evicted_sessions.load()
+                          << " oversized_messages=" << metrics.oversized_messages.load() << std::endl;
+                schedule_metrics();
+            });
+        };
+        if (metrics_interval.count() > 0) {
+            schedule_metrics();
+        }
+
+        auto server = std::make_shared<WebSocketServer>(ioc, notification_manager, metrics, session_options);
         server->run(env_or("WS_HOST", "0.0.0.0"),
                     static_cast<unsigned short>(std::stoi(env_or("WS_PORT", "8080"))));
 
         std::cout << "WebSocket Service starting on port 8080..." << std::endl;
         ioc.run();
-
-        running.store(false);
-        if (consumer.joinable()) consumer.join();
     } catch (const std::exception& e) {
         std::cerr << "Fatal error: " << e.what() << std::endl;
         return 1;
@@ -3,6 +3,9 @@
 #include <stdexcept>
 #include <string>
 #include <sys/time.h>
+#include <iostream>
+#include <vector>
+#include "event_batch.hpp"
 
 static void ensure_ok(const amqp_rpc_reply_t& reply, const char* what) {
     if (reply.reply_type != AMQP_RESPONSE_NORMAL) {
@@ -10,6 +13,31 @@ static void ensure_ok(const amqp_rpc_reply_t& reply, const char* what) {
     }
 }
 
+static std::string content_type_of(const amqp_envelope_t& envelope) {
+    const auto& props = envelope.message.properties;
+    if (!(props._flags & AMQP_BASIC_CONTENT_TYPE_FLAG)) return {};
+    return std::string(static_cast<char*>(props.content_type.bytes), props.content_type.len);
+}
+
+static bool is_event_batch(const amqp_envelope_t& envelope) {
+    const auto& props = envelope.message.properties;
+    if (!(props._flags & AMQP_BASIC_TYPE_FLAG)) return false;
+    return std::string(static_cast<char*>(props.type.bytes), props.type.len) == event_batch::message_type();
+}
+
+// One entry per event carried by the delivery; a malformed envelope yields none.
+static std::vector<std::string> events_of(const amqp_envelope_t& envelope) {
+    std::string body(static_cast<char*>(envelope.message.body.bytes), envelope.message.body.len);
+    if (!is_event_batch(envelope)) return {std::move(body)};
+
+    try {
+        return event_batch::unpack(body);
+    } catch (const std::exception& e) {
+        std::cerr << "Dropping malformed event batch: " << e.what() << std::endl;
+        return {};
+    }
+}
+
 MessageQueue::MessageQueue(const MessageQueueConfig& config) {
     connection_ = amqp_new_connection();
     if (!connection_) {
@@ -73,39 +101,77 @@ void MessageQueue::publish(const std::string& queue, const std::string& message)
     }
 }
 
-void MessageQueue::consume(const std::string& queue,
-                           std::function<void(const std::string&)> callback,
-                           std::atomic_bool& running) {
+void MessageQueue::start_consuming(const std::string& queue) {
     amqp_bytes_t queue_bytes = amqp_cstring_bytes(queue.c_str());
 
     amqp_queue_declare(connection_, channel_, queue_bytes, 0, 1, 0, 0, amqp_empty_table);
     auto reply = amqp_get_rpc_reply(connection_);
     ensure_ok(reply, "queue_declare");
 
-    amqp_basic_consume(connection_, channel_, queue_bytes, amqp_empty_bytes, 0, 1, 0, amqp_empty_table);
+    basic_consume(queue_bytes);
+}
+
+std::string MessageQueue::start_consuming_exchange(const std::string& exchange,
+                                                   const std::vector<std::string>& binding_keys) {
+    amqp_bytes_t exchange_bytes = amqp_cstring_bytes(exchange.c_str());
+
+    amqp_exchange_declare(connection_, channel_, exchange_bytes, amqp_cstring_bytes("topic"),
+                          0, 1, 0, 0, amqp_empty_table);
+    auto reply = amqp_get_rpc_reply(connection_);
+    ensure_ok(reply, "exchange_declare");
+
+    auto* declared = amqp_queue_declare(connection_, channel_, amqp_empty_bytes, 0, 0, 1, 1, amqp_empty_table);
     reply = amqp_get_rpc_reply(connection_);
+    ensure_ok(reply, "queue_declare");
+
+    std::string queue(static_cast<char*>(declared->queue.bytes), declared->queue.len);
+    amqp_bytes_t queue_bytes = amqp_cstring_bytes(queue.c_str());
+
+    for (const auto& key : binding_keys) {
+        amqp_queue_bind(connection_, channel_, queue_bytes, exchange_bytes,
+                        amqp_cstring_bytes(key.c_str()), amqp_empty_table);
+        reply = amqp_get_rpc_reply(connection_);
+        ensure_ok(reply, "queue_bind");
+    }
+
+    basic_consume(queue_bytes);
+    return queue;
+}
+
+void MessageQueue::basic_consume(amqp_bytes_t queue) {
+    amqp_basic_consume(connection_, channel_, queue, amqp_empty_bytes, 0, 1, 0, amqp_empty_table);
+    auto reply = amqp_get_rpc_reply(connection_);
     ensure_ok(reply, "basic_consume");
+}
 
-    while (running.load()) {
+void MessageQueue::drain(const MessageHandler& callback) {
+    timeval no_wait;
+    no_wait.tv_sec = 0;
+    no_wait.tv_usec = 0;
+
+    while (true) {
         amqp_envelope_t envelope;
         amqp_maybe_release_buffers(connection_);
 
-        timeval timeout;
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
-
-        amqp_rpc_reply_t ret = amqp_consume_message(connection_, &envelope, &timeout, 0);
+        amqp_rpc_reply_t ret = amqp_consume_message(connection_, &envelope, &no_wait, 0);
         if (ret.reply_type == AMQP_RESPONSE_NORMAL) {
-            std::string msg(static_cast<char*>(envelope.message.body.bytes), envelope.message.body.len);
-            callback(msg);
+            auto content_type = content_type_of(envelope);
+            auto events = events_of(envelope);
             amqp_destroy_envelope(&envelope);
+            for (const auto& event : events) {
+                callback(event, content_type);
+            }
             continue;
         }
 
         if (ret.reply_type == AMQP_RESPONSE_LIBRARY_EXCEPTION && ret.library_error == AMQP_STATUS_TIMEOUT) {
-            continue;
+            return;
         }
 
         throw std::runtime_error("RabbitMQ consume error");
     }
 }
+
+int MessageQueue::socket_fd() const {
+    return amqp_get_sockfd(connection_);
+}
@@ -1,39 +1,150 @@
 #include "notification_manager.hpp"
 #include "websocket_server.hpp"
+#include <algorithm>
+#include <functional>
+
+namespace {
+
+bool same_owner(const std::weak_ptr<WebSocketSession>& a, const std::weak_ptr<WebSocketSession>& b) {
+    return !a.owner_before(b) && !b.owner_before(a);
+}
+
+}
+
+NotificationManager::Registry::Registry(std::size_t shard_count) {
+    std::size_t count = 1;
+    while (count < shard_count) count <<= 1;
+
+    shards_.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        shards_.push_back(std::make_unique<Shard>());
+    }
+    shard_mask_ = count - 1;
+}
+
+NotificationManager::Registry::Shard& NotificationManager::Registry::shard_for(const std::string& key) {
+    return *shards_[std::hash<std::string>{}(key) & shard_mask_];
+}
+
+void NotificationManager::Registry::add(const std::string& key, const std::shared_ptr<WebSocketSession>& session) {
+    auto& shard = shard_for(key);
+    std::weak_ptr<WebSocketSession> weak = session;
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto& list = shard.subscriptions[key];
+    auto it = std::find_if(list.begin(), list.end(), [&](const WeakSession& w) { return same_owner(w, weak); });
+    if (it == list.end()) {
+        list.push_back(std::move(weak));
+    }
+}
+
+void NotificationManager::Registry::remove(const std::string& key, const std::shared_ptr<WebSocketSession>& session) {
+    auto& shard = shard_for(key);
+    std::weak_ptr<WebSocketSession> weak = session;
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.subscriptions.find(key);
+    if (it == shard.subscriptions.end()) return;
+
+    auto& list = it->second;
+    auto pos = std::find_if(list.begin(), list.end(), [&](const WeakSession& w) { return same_owner(w, weak); });
+    if (pos != list.end()) {
+        *pos = std::move(list.back());
+        list.pop_back();
+    }
+
+    if (list.empty()) {
+        shard.subscriptions.erase(it);
+    }
+}
+
+NotificationManager::WeakList NotificationManager::Registry::snapshot(const std::string& key) {
+    auto& shard = shard_for(key);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.subscriptions.find(key);
+    if (it == shard.subscriptions.end()) return {};
+    return it->second;
+}
+
+void NotificationManager::Registry::prune_expired(const std::string& key) {
+    auto& shard = shard_for(key);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.subscriptions.find(key);
+    if (it == shard.subscriptions.end()) return;
+
+    auto& list = it->second;
+    list.erase(std::remove_if(list.begin(), list.end(), [](const WeakSession& w) { return w.expired(); }),
+               list.end());
+
+    if (list.empty()) {
+        shard.subscriptions.erase(it);
+    }
+}
+
+NotificationManager::NotificationManager(OrderStateCache& state_cache, std::size_t shard_count)
+    : state_cache_(state_cache), orders_(shard_count), users_(shard_count) {
+}
 
 void NotificationManager::subscribe(const std::string& order_id, const std::shared_ptr<WebSocketSession>& session) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    subscriptions_[order_id].insert(session);
+    orders_.add(order_id, session);
 }
 
 void NotificationManager::unsubscribe(const std::string& order_id, const std::shared_ptr<WebSocketSession>& session) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto it = subscriptions_.find(order_id);
-    if (it == subscriptions_.end()) return;
+    orders_.remove(order_id, session);
+}
 
-    it->second.erase(session);
-    if (it->second.empty()) {
-        subscriptions_.erase(it);
-    }
+void NotificationManager::subscribe_user(const std::string& user_id, const std::shared_ptr<WebSocketSession>& session) {
+    users_.add(user_id, session);
 }
 
-void NotificationManager::notify(const std::string& order_id, const nlohmann::json& message) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto it = subscriptions_.find(order_id);
-    if (it == subscriptions_.end()) return;
+void NotificationManager::unsubscribe_user(const std::string& user_id, const std::shared_ptr<WebSocketSession>& session) {
+    users_.remove(user_id, session);
+}
 
-    auto payload = message.dump();
+void NotificationManager::collect(Registry& registry, const std::string& key,
+                                  std::vector<std::shared_ptr<WebSocketSession>>& targets) {
+    if (key.empty()) return;
 
-    for (auto iter = it->second.begin(); iter != it->second.end();) {
-        if (auto s = iter->lock()) {
-            s->send(payload);
-            ++iter;
+    bool saw_expired = false;
+    for (const auto& weak : registry.snapshot(key)) {
+        if (auto s = weak.lock()) {
+            targets.push_back(std::move(s));
         } else {
-            iter = it->second.erase(iter);
+            saw_expired = true;
         }
     }
 
-    if (it->second.empty()) {
-        subscriptions_.erase(it);
+    if (saw_expired) {
+        registry.prune_expired(key);
     }
 }
+
+void NotificationManager::notify(const std::string& order_id, const std::string& user_id, nlohmann::json message) {
+    auto seq = state_cache_.next_sequence();
+    message["seq"] = seq;
+    message["epoch"] = state_cache_.epoch();
+
+    // One allocation for the whole fan-out; sessions only bump the reference count.
+    auto shared = std::make_shared<const OutboundMessage>(OutboundMessage{message.dump(), order_id});
+    state_cache_.store(order_id, seq, shared);
+
+    std::vector<std::shared_ptr<WebSocketSession>> targets;
+    collect(orders_, order_id, targets);
+    collect(users_, user_id, targets);
+
+    if (targets.empty()) return;
+
+    std::sort(targets.begin(), targets.end());
+    targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+
+    for (const auto& s : targets) {
+        s->send(shared);
+    }
+}
+
+SharedMessage NotificationManager::last_state(const std::string& order_id, std::uint64_t since_seq, std::uint64_t epoch) {
+    if (epoch != state_cache_.epoch()) since_seq = 0;
+    return state_cache_.lookup(order_id, since_seq);
+}
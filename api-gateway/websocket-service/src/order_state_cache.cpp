@@ -0,0 +1,84 @@
+#include "order_state_cache.hpp"
+#include <functional>
+#include <iterator>
+
+OrderStateCache::OrderStateCache(std::size_t max_entries, std::chrono::seconds ttl, std::size_t shard_count)
+    : ttl_(ttl),
+      epoch_(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::system_clock::now().time_since_epoch()).count())) {
+    std::size_t count = 1;
+    while (count < shard_count) count <<= 1;
+
+    shards_.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        shards_.push_back(std::make_unique<Shard>());
+    }
+    shard_mask_ = count - 1;
+
+    max_entries_per_shard_ = max_entries / count;
+    if (max_entries_per_shard_ == 0) max_entries_per_shard_ = 1;
+}
+
+OrderStateCache::Shard& OrderStateCache::shard_for(const std::string& order_id) {
+    return *shards_[std::hash<std::string>{}(order_id) & shard_mask_];
+}
+
+std::uint64_t OrderStateCache::next_sequence() {
+    return sequence_.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+void OrderStateCache::evict_front(Shard& shard) {
+    shard.entries.erase(shard.age.front());
+    shard.age.pop_front();
+}
+
+void OrderStateCache::store(const std::string& order_id, std::uint64_t seq, SharedMessage message) {
+    auto& shard = shard_for(order_id);
+    auto now = Clock::now();
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    while (!shard.age.empty() && now - shard.entries.at(shard.age.front()).updated_at > ttl_) {
+        evict_front(shard);
+    }
+
+    auto it = shard.entries.find(order_id);
+    if (it != shard.entries.end()) {
+        if (it->second.seq > seq) return;
+
+        it->second.message = std::move(message);
+        it->second.seq = seq;
+        it->second.updated_at = now;
+        shard.age.splice(shard.age.end(), shard.age, it->second.age_pos);
+        return;
+    }
+
+    if (shard.entries.size() >= max_entries_per_shard_) {
+        evict_front(shard);
+    }
+
+    shard.age.push_back(order_id);
+    Entry entry;
+    entry.message = std::move(message);
+    entry.seq = seq;
+    entry.updated_at = now;
+    entry.age_pos = std::prev(shard.age.end());
+    shard.entries.emplace(order_id, std::move(entry));
+}
+
+SharedMessage OrderStateCache::lookup(const std::string& order_id, std::uint64_t since_seq) {
+    auto& shard = shard_for(order_id);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.entries.find(order_id);
+    if (it == shard.entries.end()) return nullptr;
+
+    if (Clock::now() - it->second.updated_at > ttl_) {
+        shard.age.erase(it->second.age_pos);
+        shard.entries.erase(it);
+        return nullptr;
+    }
+
+    if (it->second.seq <= since_seq) return nullptr;
+    return it->second.message;
+}
@@ -4,13 +4,23 @@
 
 using json = nlohmann::json;
 
-WebSocketSession::WebSocketSession(tcp::socket socket, asio::io_context& ioc, NotificationManager& notification_manager)
+WebSocketSession::WebSocketSession(tcp::socket socket, asio::io_context& ioc, NotificationManager& notification_manager,
+                                   const WebSocketSessionOptions& options, WebSocketMetrics& metrics)
     : ws_(std::move(socket)),
       strand_(asio::make_strand(ioc)),
-      notification_manager_(notification_manager) {
+      notification_manager_(notification_manager),
+      options_(options),
+      metrics_(metrics) {
 }
 
 void WebSocketSession::start() {
+    if (options_.permessage_deflate) {
+        websocket::permessage_deflate pmd;
+        pmd.server_enable = true;
+        pmd.compLevel = options_.deflate_level;
+        ws_.set_option(pmd);
+    }
+
     ws_.async_accept(
         asio::bind_executor(
             strand_,
@@ -21,7 +31,7 @@ void WebSocketSession::start() {
     );
 }
 
-void WebSocketSession::send(std::string message) {
+void WebSocketSession::send(SharedMessage message) {
     asio::post(
         strand_,
         [self = shared_from_this(), msg = std::move(message)]() mutable {
@@ -30,6 +40,10 @@ void WebSocketSession::send(std::string message) {
     );
 }
 
+void WebSocketSession::send(std::string message) {
+    send(std::make_shared<const OutboundMessage>(OutboundMessage{std::move(message), {}}));
+}
+
 void WebSocketSession::on_accept(beast::error_code ec) {
     if (ec) return;
     do_read();
@@ -48,28 +62,49 @@ void WebSocketSession::do_read() {
 }
 
 void WebSocketSession::on_read(beast::error_code ec, std::size_t) {
-    if (ec == websocket::error::closed) {
-        if (!order_id_.empty()) {
-            notification_manager_.unsubscribe(order_id_, shared_from_this());
-        }
+    if (ec) {
+        release_subscriptions();
         return;
     }
 
-    if (ec) return;
-
     try {
         auto text = beast::buffers_to_string(buffer_.data());
         auto j = json::parse(text);
+        auto type = j.value("type", std::string{});
+
+        if ((type == "subscribe" || type == "unsubscribe") && j.contains("order_id")) {
+            auto order_id = j.at("order_id").get<std::string>();
+
+            if (type == "subscribe") {
+                if (order_ids_.insert(order_id).second) {
+                    notification_manager_.subscribe(order_id, shared_from_this());
+                }
+            } else if (order_ids_.erase(order_id)) {
+                notification_manager_.unsubscribe(order_id, shared_from_this());
+            }
 
-        if (j.value("type", std::string{}) == "subscribe" && j.contains("order_id")) {
-            if (!order_id_.empty()) {
-                notification_manager_.unsubscribe(order_id_, shared_from_this());
+            json resp = {{"type", type == "subscribe" ? "subscribed" : "unsubscribed"}, {"order_id", order_id}};
+            send(resp.dump());
+
+            if (type == "subscribe") {
+                auto since_seq = j.value("since_seq", std::uint64_t{0});
+                auto epoch = j.value("epoch", std::uint64_t{0});
+                if (auto state = notification_manager_.last_state(order_id, since_seq, epoch)) {
+                    send(std::move(state));
+                }
             }
+        } else if ((type == "subscribe_user" || type == "unsubscribe_user") && j.contains("user_id")) {
+            auto user_id = j.at("user_id").get<std::string>();
 
-            order_id_ = j.at("order_id").get<std::string>();
-            notification_manager_.subscribe(order_id_, shared_from_this());
+            if (type == "subscribe_user") {
+                if (user_ids_.insert(user_id).second) {
+                    notification_manager_.subscribe_user(user_id, shared_from_this());
+                }
+            } else if (user_ids_.erase(user_id)) {
+                notification_manager_.unsubscribe_user(user_id, shared_from_this());
+            }
 
-            json resp = {{"type", "subscribed"}, {"order_id", order_id_}};
+            json resp = {{"type", type == "subscribe_user" ? "subscribed_user" : "unsubscribed_user"}, {"user_id", user_id}};
             send(resp.dump());
         }
     } catch (...) {
@@ -79,46 +114,156 @@ void WebSocketSession::on_read(beast::error_code ec, std::size_t) {
     do_read();
 }
 
-void WebSocketSession::enqueue_write(std::string message) {
+void WebSocketSession::release_subscriptions() {
+    auto self = shared_from_this();
+    for (const auto& order_id : order_ids_) {
+        notification_manager_.unsubscribe(order_id, self);
+    }
+    for (const auto& user_id : user_ids_) {
+        notification_manager_.unsubscribe_user(user_id, self);
+    }
+    order_ids_.clear();
+    user_ids_.clear();
+}
+
+void WebSocketSession::enqueue_write(SharedMessage message) {
+    if (closing_) return;
+
+    // It could never fit: drop_oldest would empty the queue and then drop it anyway, and
+    // close would evict a client that is keeping up.
+    if (message->payload.size() > options_.max_queue_bytes) {
+        metrics_.oversized_messages.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    queued_bytes_ += message->payload.size();
     write_queue_.push_back(std::move(message));
-    if (!writing_) {
+
+    if (queue_over_limit()) {
+        apply_slow_consumer_policy();
+    }
+
+    if (!writing_ && !closing_) {
         do_write();
     }
 }
 
-void WebSocketSession::do_write() {
-    if (write_queue_.empty()) {
-        writing_ = false;
+bool WebSocketSession::queue_over_limit() const {
+    return write_queue_.size() > options_.max_queue_messages ||
+           queued_bytes_ > options_.max_queue_bytes;
+}
+
+void WebSocketSession::apply_slow_consumer_policy() {
+    switch (options_.slow_consumer_policy) {
+    case SlowConsumerPolicy::close:
+        evict();
         return;
+    case SlowConsumerPolicy::conflate:
+        conflate_pending();
+        break;
+    case SlowConsumerPolicy::drop_oldest:
+        break;
     }
 
-    writing_ = true;
+    // Entries before in_flight_ are referenced by the pending async_write and must stay.
+    while (queue_over_limit() && write_queue_.size() > in_flight_) {
+        drop_pending_at(in_flight_);
+    }
+}
+
+void WebSocketSession::conflate_pending() {
+    std::unordered_set<std::string> seen;
+    for (std::size_t i = write_queue_.size(); i > in_flight_; --i) {
+        const auto& key = write_queue_[i - 1]->conflation_key;
+        if (key.empty()) continue;
+        if (!seen.insert(key).second) {
+            drop_pending_at(i - 1);
+        }
+    }
+}
 
-    ws_.async_write(
-        asio::buffer(write_queue_.front()),
+void WebSocketSession::drop_pending_at(std::size_t index) {
+    auto it = write_queue_.begin() + static_cast<std::ptrdiff_t>(index);
+    queued_bytes_ -= (*it)->payload.size();
+    write_queue_.erase(it);
+    metrics_.dropped_messages.fetch_add(1, std::memory_order_relaxed);
+}
+
+void WebSocketSession::evict() {
+    closing_ = true;
+    metrics_.evicted_sessions.fetch_add(1, std::memory_order_relaxed);
+
+    while (write_queue_.size() > in_flight_) {
+        drop_pending_at(write_queue_.size() - 1);
+    }
+    release_subscriptions();
+
+    ws_.async_close(
+        websocket::close_reason(static_cast<websocket::close_code>(options_.slow_consumer_close_code), "slow consumer"),
         asio::bind_executor(
             strand_,
-            [self = shared_from_this()](beast::error_code ec, std::size_t bytes_transferred) {
-                self->on_write(ec, bytes_transferred);
+            [self = shared_from_this()](beast::error_code) {
             }
         )
     );
 }
 
+void WebSocketSession::do_write() {
+    if (write_queue_.empty()) {
+        writing_ = false;
+        return;
+    }
+
+    writing_ = true;
+
+    auto handler = asio::bind_executor(
+        strand_,
+        [self = shared_from_this()](beast::error_code ec, std::size_t bytes_transferred) {
+            self->on_write(ec, bytes_transferred);
+        }
+    );
+
+    if (!options_.coalesce_writes || write_queue_.size() == 1) {
+        in_flight_ = 1;
+        ws_.async_write(asio::buffer(write_queue_.front()->payload), std::move(handler));
+        return;
+    }
+
+    static const char open_bracket = '[';
+    static const char comma = ',';
+    static const char close_bracket = ']';
+
+    write_buffers_.clear();
+    write_buffers_.reserve(write_queue_.size() * 2 + 1);
+    write_buffers_.emplace_back(&open_bracket, 1);
+    for (const auto& message : write_queue_) {
+        if (write_buffers_.size() > 1) write_buffers_.emplace_back(&comma, 1);
+        write_buffers_.push_back(asio::buffer(message->payload));
+    }
+    write_buffers_.emplace_back(&close_bracket, 1);
+
+    in_flight_ = write_queue_.size();
+    ws_.async_write(write_buffers_, std::move(handler));
+}
+
 void WebSocketSession::on_write(beast::error_code ec, std::size_t) {
     if (ec) {
-        if (!order_id_.empty()) {
-            notification_manager_.unsubscribe(order_id_, shared_from_this());
-        }
+        release_subscriptions();
         return;
     }
 
-    write_queue_.pop_front();
+    for (std::size_t i = 0; i < in_flight_; ++i) {
+        queued_bytes_ -= write_queue_.front()->payload.size();
+        write_queue_.pop_front();
+    }
+    in_flight_ = 0;
     do_write();
 }
 
-WebSocketServer::WebSocketServer(asio::io_context& ioc, NotificationManager& notification_manager)
-    : ioc_(ioc), acceptor_(ioc), notification_manager_(notification_manager) {
+WebSocketServer::WebSocketServer(asio::io_context& ioc, NotificationManager& notification_manager,
+                                 WebSocketMetrics& metrics, const WebSocketSessionOptions& options)
+    : ioc_(ioc), acceptor_(ioc), notification_manager_(notification_manager),
+      metrics_(metrics), options_(options) {
 }
 
 void WebSocketServer::run(const std::string& address, unsigned short port) {
@@ -140,6 +285,6 @@ void WebSocketServer::do_accept() {
 
 void WebSocketServer::on_accept(beast::error_code ec, tcp::socket socket) {
     if (ec) return;
-    std::make_shared<WebSocketSession>(std::move(socket), ioc_, notification_manager_)->start();
+    std::make_shared<WebSocketSession>(std::move(socket), ioc_, notification_manager_, options_, metrics_)->start();
     do_accept();
 }